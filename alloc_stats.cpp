@@ -0,0 +1,62 @@
+#include "alloc_stats.h"
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+// Replaces the global operator new/delete to count allocated bytes
+static std::atomic<size_t> totalBytes(0);
+
+static void *countedAlloc(size_t size) {
+    totalBytes.fetch_add(size, std::memory_order_relaxed);
+    for (;;) {
+        void *p = std::malloc(size ? size : 1);
+        if (p) return p;
+        std::new_handler handler = std::get_new_handler();
+        if (!handler) throw std::bad_alloc();
+        handler();
+    }
+}
+
+size_t alloc_stats_total_bytes() {
+    return totalBytes.load(std::memory_order_relaxed);
+}
+
+void *operator new(size_t size) {
+    return countedAlloc(size);
+}
+
+void *operator new[](size_t size) {
+    return countedAlloc(size);
+}
+
+void *operator new(size_t size, const std::nothrow_t&) noexcept {
+    try {
+        return countedAlloc(size);
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+void *operator new[](size_t size, const std::nothrow_t&) noexcept {
+    try {
+        return countedAlloc(size);
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+void operator delete(void *p) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void *p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void *p, const std::nothrow_t&) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void *p, const std::nothrow_t&) noexcept {
+    std::free(p);
+}
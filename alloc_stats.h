@@ -0,0 +1,13 @@
+#ifndef ALLOC_STATS_H
+#define ALLOC_STATS_H
+
+#include <cstddef>
+
+// Total bytes requested from operator new since the program started, on all
+// threads. Frees are not subtracted; take the difference of two readings to
+// get the bytes allocated in between. Counting replaces the global allocator,
+// so only programs linking alloc_stats.cpp count; the rest link
+// alloc_stats_none.cpp and always read 0.
+size_t alloc_stats_total_bytes();
+
+#endif // ALLOC_STATS_H
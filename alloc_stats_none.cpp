@@ -0,0 +1,6 @@
+#include "alloc_stats.h"
+
+// Builds that keep the standard allocator count nothing
+size_t alloc_stats_total_bytes() {
+    return 0;
+}
@@ -0,0 +1,61 @@
+#include "autotile.h"
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+const uint8_t Autotiler::N;
+const uint8_t Autotiler::NE;
+const uint8_t Autotiler::E;
+const uint8_t Autotiler::SE;
+const uint8_t Autotiler::S;
+const uint8_t Autotiler::SW;
+const uint8_t Autotiler::W;
+const uint8_t Autotiler::NW;
+
+// Variants index a palette of at most 256 entries shared with other tiles
+static const int MAX_VARIANTS = 255;
+
+Autotiler::Autotiler() {
+    std::memset(variantOf, 0, sizeof(variantOf));
+}
+
+int Autotiler::addVariant(int tileId) {
+    std::vector<int>::iterator found = std::find(variantTiles.begin(), variantTiles.end(), tileId);
+    if (found != variantTiles.end()) {
+        return (int)(found - variantTiles.begin());
+    }
+    if ((int)variantTiles.size() >= MAX_VARIANTS) {
+        std::cerr << "Too many autotile variants, cannot add tile " << tileId << std::endl;
+        return -1;
+    }
+    variantTiles.push_back(tileId);
+    return (int)variantTiles.size() - 1;
+}
+
+bool Autotiler::setEdgeTiles(const std::vector<int> &tileIds) {
+    if (tileIds.size() != 16) {
+        std::cerr << "Autotile edge set needs 16 tiles, got " << tileIds.size() << std::endl;
+        return false;
+    }
+    variantTiles.clear();
+    int variants[16];
+    for (int i = 0; i < 16; i++) {
+        variants[i] = addVariant(tileIds[i]);
+    }
+    for (int mask = 0; mask < 256; mask++) {
+        int open = (mask & N ? 0 : 1) | (mask & E ? 0 : 2) | (mask & S ? 0 : 4) | (mask & W ? 0 : 8);
+        variantOf[mask] = (uint8_t)variants[open];
+    }
+    return true;
+}
+
+bool Autotiler::setMaskTile(uint8_t mask, int tileId) {
+    int variant = addVariant(tileId);
+    if (variant < 0) return false;
+    variantOf[mask] = (uint8_t)variant;
+    return true;
+}
+
+bool Autotiler::isVariantTile(int tileId) const {
+    return std::find(variantTiles.begin(), variantTiles.end(), tileId) != variantTiles.end();
+}
@@ -0,0 +1,43 @@
+#ifndef AUTOTILE_H
+#define AUTOTILE_H
+
+#include <vector>
+#include <cstdint>
+
+// Picks the tile for a wall cell from which of its 8 neighbours are walls
+// too. The choice is a 256-entry table indexed by the neighbour mask, each
+// entry one of a few variants (tile ids), so retiling a cell is one lookup.
+class Autotiler {
+private:
+    uint8_t variantOf[256];         // neighbour mask -> variant
+    std::vector<int> variantTiles;  // variant -> tile id
+
+    int addVariant(int tileId);
+
+public:
+    // Neighbour bits, set where that neighbour is a wall
+    static const uint8_t N = 1;
+    static const uint8_t NE = 2;
+    static const uint8_t E = 4;
+    static const uint8_t SE = 8;
+    static const uint8_t S = 16;
+    static const uint8_t SW = 32;
+    static const uint8_t W = 64;
+    static const uint8_t NW = 128;
+
+    Autotiler();
+
+    // 16 tile ids indexed by which sides face open cells (N = 1, E = 2,
+    // S = 4, W = 8); diagonal neighbours do not matter. Replaces the table.
+    bool setEdgeTiles(const std::vector<int> &tileIds);
+    // Override the tile for one exact mask (e.g. an inner corner)
+    bool setMaskTile(uint8_t mask, int tileId);
+
+    bool empty() const { return variantTiles.empty(); }
+    uint8_t variantFor(uint8_t mask) const { return variantOf[mask]; }
+    int getVariantCount() const { return (int)variantTiles.size(); }
+    int getVariantTile(int variant) const { return variantTiles[variant]; }
+    bool isVariantTile(int tileId) const;
+};
+
+#endif // AUTOTILE_H
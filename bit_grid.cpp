@@ -0,0 +1,86 @@
+#include "bit_grid.h"
+#include "thread_pool.h"
+
+void BitGrid::resize(int w, int h) {
+    width = w;
+    height = h;
+    wordsPerRow = (w + 63) / 64;
+    stride = wordsPerRow + 2;
+    words.assign((size_t)stride * h, 0);
+}
+
+void BitGrid::clear() {
+    std::fill(words.begin(), words.end(), 0);
+}
+
+void BitGrid::setSpan(int y, int x0, int x1) {
+    if (x0 > x1) return;
+    uint64_t *r = row(y);
+    int w0 = x0 >> 6;
+    int w1 = x1 >> 6;
+    uint64_t first = ~(uint64_t)0 << (x0 & 63);
+    uint64_t last = ~(uint64_t)0 >> (63 - (x1 & 63));
+    if (w0 == w1) {
+        r[w0] |= first & last;
+        return;
+    }
+    r[w0] |= first;
+    for (int i = w0 + 1; i < w1; i++) {
+        r[i] = ~(uint64_t)0;
+    }
+    r[w1] |= last;
+}
+
+void BitGrid::pack(const TileGrid &grid, uint8_t value, ThreadPool *pool) {
+    if (grid.getWidth() != width || grid.getHeight() != height) {
+        resize(grid.getWidth(), grid.getHeight());
+    }
+
+    std::function<void(int, int)> packRows = [this, &grid, value](int y0, int y1) {
+        for (int y = y0; y < y1; y++) {
+            const uint8_t *src = grid.row(y);
+            uint64_t *dst = row(y);
+            for (int i = 0; i < wordsPerRow; i++) {
+                int x0 = i * 64;
+                int n = std::min(64, width - x0);
+                uint64_t bits = 0;
+                for (int b = 0; b < n; b++) {
+                    bits |= (uint64_t)(src[x0 + b] == value) << b;
+                }
+                dst[i] = bits;
+            }
+        }
+    };
+    if (pool) {
+        pool->parallelFor(0, height, packRows, 16);
+    } else {
+        packRows(0, height);
+    }
+}
+
+void BitGrid::unpackInterior(TileGrid &grid, uint8_t setValue, uint8_t clearValue,
+                             ThreadPool *pool) const {
+    std::function<void(int, int)> unpackRows = [this, &grid, setValue, clearValue](int y0, int y1) {
+        for (int y = y0; y < y1; y++) {
+            const uint64_t *src = row(y);
+            uint8_t *dst = grid.row(y);
+            for (int x = 1; x < width - 1; x++) {
+                dst[x] = ((src[x >> 6] >> (x & 63)) & 1) ? setValue : clearValue;
+            }
+        }
+    };
+    if (height < 3) return;
+    if (pool) {
+        pool->parallelFor(1, height - 1, unpackRows, 16);
+    } else {
+        unpackRows(1, height - 1);
+    }
+}
+
+uint64_t BitGrid::count() const {
+    uint64_t total = 0;
+    for (size_t i = 0; i < words.size(); i++) {
+        total += __builtin_popcountll(words[i]);
+    }
+    return total;
+}
@@ -0,0 +1,62 @@
+#ifndef BIT_GRID_H
+#define BIT_GRID_H
+
+#include <vector>
+#include <cstdint>
+#include "grid.h"
+
+class ThreadPool;
+
+// Bit-packed 2D grid, 64 cells per word. Each row is padded with one zero
+// guard word on either side so kernels can read the words left and right of
+// any row word without bounds checks.
+class BitGrid {
+private:
+    int width;
+    int height;
+    int wordsPerRow;
+    int stride;     // wordsPerRow + 2 guard words
+    std::vector<uint64_t> words;
+
+public:
+    BitGrid() : width(0), height(0), wordsPerRow(0), stride(0) {}
+    BitGrid(int w, int h) { resize(w, h); }
+
+    void resize(int w, int h);
+    void clear();
+
+    int getWidth() const { return width; }
+    int getHeight() const { return height; }
+    int getWordsPerRow() const { return wordsPerRow; }
+
+    // Row words; row(y)[-1] and row(y)[wordsPerRow] are the zero guards
+    uint64_t* row(int y) { return &words[(size_t)y * stride + 1]; }
+    const uint64_t* row(int y) const { return &words[(size_t)y * stride + 1]; }
+
+    bool get(int x, int y) const {
+        return (row(y)[x >> 6] >> (x & 63)) & 1;
+    }
+    void set(int x, int y) {
+        row(y)[x >> 6] |= (uint64_t)1 << (x & 63);
+    }
+    void reset(int x, int y) {
+        row(y)[x >> 6] &= ~((uint64_t)1 << (x & 63));
+    }
+
+    // Set bits [x0, x1] (inclusive) of row y
+    void setSpan(int y, int x0, int x1);
+
+    // Set bit where cell == value. Reuses the existing allocation when the
+    // size matches; rows are split across the pool if one is given.
+    void pack(const TileGrid &grid, uint8_t value, ThreadPool *pool = nullptr);
+
+    // Write setValue/clearValue into the grid for every cell inside the one
+    // cell border; border cells of the grid are left untouched
+    void unpackInterior(TileGrid &grid, uint8_t setValue, uint8_t clearValue,
+                        ThreadPool *pool = nullptr) const;
+
+    // Number of set bits
+    uint64_t count() const;
+};
+
+#endif // BIT_GRID_H
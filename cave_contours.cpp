@@ -0,0 +1,252 @@
+#include "cave_contours.h"
+#include "thread_pool.h"
+#include <cmath>
+#include <utility>
+#include <algorithm>
+
+// Square corners: a square joins the centres of cells (x, y) .. (x + 1, y + 1)
+static const int CORNER_TL = 8;
+static const int CORNER_TR = 4;
+static const int CORNER_BR = 2;
+static const int CORNER_BL = 1;
+
+// Square edges and their midpoints relative to the top-left cell centre
+enum { EDGE_TOP, EDGE_RIGHT, EDGE_BOTTOM, EDGE_LEFT };
+static const float EDGE_X[4] = { 0.5f, 1.0f, 0.5f, 0.0f };
+static const float EDGE_Y[4] = { 0.0f, 0.5f, 1.0f, 0.5f };
+
+// Bits 4 and 5 of a square's case byte mark its segments as traced
+static const uint8_t VISITED_SHIFT = 4;
+
+// Oriented segments (from edge, to edge) for each case, walls on the right
+struct SquareSegments {
+    int count;
+    int from[2];
+    int to[2];
+};
+
+static SquareSegments segmentTable[16];
+
+static void orientSegment(int cases, int a, int b, SquareSegments &out) {
+    // Probe the corner between the two edges (or the top-left corner for a
+    // straight segment) and put it on the side its wall flag says
+    int probe = CORNER_TL;
+    float px = 0.0f, py = 0.0f;
+    if ((a == EDGE_TOP && b == EDGE_RIGHT) || (a == EDGE_RIGHT && b == EDGE_TOP)) {
+        probe = CORNER_TR; px = 1.0f; py = 0.0f;
+    } else if ((a == EDGE_RIGHT && b == EDGE_BOTTOM) || (a == EDGE_BOTTOM && b == EDGE_RIGHT)) {
+        probe = CORNER_BR; px = 1.0f; py = 1.0f;
+    } else if ((a == EDGE_BOTTOM && b == EDGE_LEFT) || (a == EDGE_LEFT && b == EDGE_BOTTOM)) {
+        probe = CORNER_BL; px = 0.0f; py = 1.0f;
+    }
+    float dx = EDGE_X[b] - EDGE_X[a];
+    float dy = EDGE_Y[b] - EDGE_Y[a];
+    // With y pointing down, a positive cross product is on the right
+    bool probeOnRight = dx * (py - EDGE_Y[a]) - dy * (px - EDGE_X[a]) > 0.0f;
+    bool probeIsWall = (cases & probe) != 0;
+    if (probeOnRight != probeIsWall) std::swap(a, b);
+    out.from[out.count] = a;
+    out.to[out.count] = b;
+    out.count++;
+}
+
+static void buildSegmentTable() {
+    // Unoriented segments per case; the saddles (5 and 10) cut off their
+    // floor corners so diagonal walls stay joined
+    static const int PAIRS[16][4] = {
+        { -1, -1, -1, -1 },
+        { EDGE_LEFT, EDGE_BOTTOM, -1, -1 },
+        { EDGE_BOTTOM, EDGE_RIGHT, -1, -1 },
+        { EDGE_LEFT, EDGE_RIGHT, -1, -1 },
+        { EDGE_TOP, EDGE_RIGHT, -1, -1 },
+        { EDGE_LEFT, EDGE_TOP, EDGE_RIGHT, EDGE_BOTTOM },
+        { EDGE_TOP, EDGE_BOTTOM, -1, -1 },
+        { EDGE_LEFT, EDGE_TOP, -1, -1 },
+        { EDGE_LEFT, EDGE_TOP, -1, -1 },
+        { EDGE_TOP, EDGE_BOTTOM, -1, -1 },
+        { EDGE_TOP, EDGE_RIGHT, EDGE_BOTTOM, EDGE_LEFT },
+        { EDGE_TOP, EDGE_RIGHT, -1, -1 },
+        { EDGE_LEFT, EDGE_RIGHT, -1, -1 },
+        { EDGE_BOTTOM, EDGE_RIGHT, -1, -1 },
+        { EDGE_LEFT, EDGE_BOTTOM, -1, -1 },
+        { -1, -1, -1, -1 },
+    };
+    for (int c = 0; c < 16; c++) {
+        segmentTable[c].count = 0;
+        for (int s = 0; s < 4 && PAIRS[c][s] >= 0; s += 2) {
+            orientSegment(c, PAIRS[c][s], PAIRS[c][s + 1], segmentTable[c]);
+        }
+    }
+}
+
+// Distance from p to segment ab
+static float segmentDistance(const ContourPoint &p, const ContourPoint &a, const ContourPoint &b) {
+    float dx = b.x - a.x;
+    float dy = b.y - a.y;
+    float lengthSq = dx * dx + dy * dy;
+    float t = 0.0f;
+    if (lengthSq > 0.0f) {
+        t = ((p.x - a.x) * dx + (p.y - a.y) * dy) / lengthSq;
+        t = std::min(1.0f, std::max(0.0f, t));
+    }
+    float ex = a.x + t * dx - p.x;
+    float ey = a.y + t * dy - p.y;
+    return std::sqrt(ex * ex + ey * ey);
+}
+
+// Douglas-Peucker on a closed loop: split at the vertex furthest from the
+// first one, then simplify both halves with an explicit stack
+static void simplifyLoop(const ContourPoint *loop, int n, float tolerance,
+                         std::vector<ContourPoint> &out) {
+    out.clear();
+    if (n <= 3) {
+        out.assign(loop, loop + n);
+        return;
+    }
+
+    int far = 0;
+    float farDist = -1.0f;
+    for (int i = 1; i < n; i++) {
+        float dx = loop[i].x - loop[0].x;
+        float dy = loop[i].y - loop[0].y;
+        float d = dx * dx + dy * dy;
+        if (d > farDist) {
+            farDist = d;
+            far = i;
+        }
+    }
+
+    // Index n stands for vertex 0 again
+    std::vector<char> keep(n + 1, 0);
+    keep[0] = keep[far] = keep[n] = 1;
+    std::vector<std::pair<int, int>> stack;
+    stack.push_back(std::make_pair(0, far));
+    stack.push_back(std::make_pair(far, n));
+    while (!stack.empty()) {
+        int i = stack.back().first;
+        int j = stack.back().second;
+        stack.pop_back();
+        const ContourPoint &a = loop[i % n];
+        const ContourPoint &b = loop[j % n];
+        int best = -1;
+        float bestDist = tolerance;
+        for (int k = i + 1; k < j; k++) {
+            float d = segmentDistance(loop[k], a, b);
+            if (d > bestDist) {
+                bestDist = d;
+                best = k;
+            }
+        }
+        if (best >= 0) {
+            keep[best] = 1;
+            stack.push_back(std::make_pair(i, best));
+            stack.push_back(std::make_pair(best, j));
+        }
+    }
+
+    for (int i = 0; i < n; i++) {
+        if (keep[i]) out.push_back(loop[i]);
+    }
+}
+
+void CaveContours::clear() {
+    points.clear();
+    loopStarts.assign(1, 0);
+    rawPointCount = 0;
+}
+
+void CaveContours::extract(const TileGrid &map, uint8_t wallValue, float tolerance, ThreadPool *pool) {
+    static bool tableReady = (buildSegmentTable(), true);
+    (void)tableReady;
+    clear();
+
+    int width = map.getWidth();
+    int height = map.getHeight();
+    if (width == 0 || height == 0) return;
+
+    // Square (sx, sy) has cell (sx - 1, sy - 1) at its top-left corner;
+    // the outer ring of squares reaches one cell outside the map
+    int squaresW = width + 1;
+    int squaresH = height + 1;
+    Grid<uint8_t> cases(squaresW, squaresH);
+    auto isWall = [&map, width, height, wallValue](int x, int y) {
+        return x < 0 || y < 0 || x >= width || y >= height || map.at(x, y) == wallValue;
+    };
+    auto classify = [&cases, &isWall, squaresW](int sy0, int sy1) {
+        for (int sy = sy0; sy < sy1; sy++) {
+            uint8_t *row = cases.row(sy);
+            for (int sx = 0; sx < squaresW; sx++) {
+                int x = sx - 1;
+                int y = sy - 1;
+                row[sx] = (uint8_t)((isWall(x, y) ? CORNER_TL : 0) |
+                                    (isWall(x + 1, y) ? CORNER_TR : 0) |
+                                    (isWall(x + 1, y + 1) ? CORNER_BR : 0) |
+                                    (isWall(x, y + 1) ? CORNER_BL : 0));
+            }
+        }
+    };
+    if (pool) {
+        pool->parallelFor(0, squaresH, classify, 16);
+    } else {
+        classify(0, squaresH);
+    }
+
+    // Trace every untraced segment around its loop, emitting the midpoint
+    // of the edge each segment starts on
+    static const int STEP_X[4] = { 0, 1, 0, -1 };
+    static const int STEP_Y[4] = { -1, 0, 1, 0 };
+    for (int sy = 0; sy < squaresH; sy++) {
+        for (int sx = 0; sx < squaresW; sx++) {
+            for (int s = 0; s < 2; s++) {
+                uint8_t c = cases.at(sx, sy);
+                const SquareSegments &segments = segmentTable[c & 15];
+                if (s >= segments.count || (c >> (VISITED_SHIFT + s)) & 1) continue;
+
+                int x = sx, y = sy, seg = s;
+                for (;;) {
+                    uint8_t &cur = cases.at(x, y);
+                    if ((cur >> (VISITED_SHIFT + seg)) & 1) break;
+                    cur |= (uint8_t)(1 << (VISITED_SHIFT + seg));
+
+                    const SquareSegments &here = segmentTable[cur & 15];
+                    int from = here.from[seg];
+                    ContourPoint p;
+                    p.x = (float)x - 0.5f + EDGE_X[from];
+                    p.y = (float)y - 0.5f + EDGE_Y[from];
+                    points.push_back(p);
+
+                    // Continue in the square across the exit edge, with the
+                    // segment that starts on the opposite edge
+                    int exit = here.to[seg];
+                    x += STEP_X[exit];
+                    y += STEP_Y[exit];
+                    int entry = (exit + 2) & 3;
+                    const SquareSegments &next = segmentTable[cases.at(x, y) & 15];
+                    seg = (next.count > 1 && next.from[1] == entry) ? 1 : 0;
+                }
+                loopStarts.push_back((int)points.size());
+            }
+        }
+    }
+    rawPointCount = points.size();
+
+    // Simplify the loops in parallel, then pack them back into one array
+    int loops = getLoopCount();
+    std::vector<std::vector<ContourPoint>> simplified(loops);
+    auto simplify = [this, &simplified, tolerance](int l0, int l1) {
+        for (int l = l0; l < l1; l++) {
+            simplifyLoop(loopPoints(l), loopSize(l), tolerance, simplified[l]);
+        }
+    };
+    if (pool) {
+        pool->parallelFor(0, loops, simplify, 64);
+    } else {
+        simplify(0, loops);
+    }
+
+    points.clear();
+    for (int l = 0; l < loops; l++) {
+        points.insert(points.end(), simplified[l].begin(), simplified[l].end());
+        loopStarts[l + 1] = (int)points.size();
+    }
+}
@@ -0,0 +1,47 @@
+#ifndef CAVE_CONTOURS_H
+#define CAVE_CONTOURS_H
+
+#include <vector>
+#include <cstdint>
+#include "grid.h"
+
+class ThreadPool;
+
+// A contour vertex in tile units (cell (x, y) spans [x, x + 1) x [y, y + 1))
+struct ContourPoint {
+    float x;
+    float y;
+};
+
+// Wall outlines as closed polylines. Marching squares runs over the cell
+// centres, with cells outside the map counted as walls so every loop
+// closes; diagonal walls join, matching the 4-connected floor regions of
+// CaveRegions. Each loop keeps walls on its right when walked in
+// order (x right, y down). All loops share one point array.
+class CaveContours {
+private:
+    std::vector<ContourPoint> points;
+    std::vector<int> loopStarts;   // loop i is [loopStarts[i], loopStarts[i + 1])
+    size_t rawPointCount;
+
+public:
+    CaveContours() : loopStarts(1, 0), rawPointCount(0) {}
+
+    // Square cases are classified in parallel row bands, loops are traced
+    // through them, then each loop is simplified with Douglas-Peucker so no
+    // dropped vertex is further than tolerance tiles from the result
+    // (0 only drops vertices on straight runs)
+    void extract(const TileGrid &map, uint8_t wallValue, float tolerance, ThreadPool *pool = nullptr);
+    void clear();
+
+    int getLoopCount() const { return (int)loopStarts.size() - 1; }
+    const std::vector<ContourPoint>& getPoints() const { return points; }
+    const std::vector<int>& getLoopStarts() const { return loopStarts; }
+    const ContourPoint* loopPoints(int loop) const { return &points[loopStarts[loop]]; }
+    int loopSize(int loop) const { return loopStarts[loop + 1] - loopStarts[loop]; }
+
+    // Vertices before simplification
+    size_t getRawPointCount() const { return rawPointCount; }
+};
+
+#endif // CAVE_CONTOURS_H
@@ -1,364 +1,477 @@
 #include "cave_generator.h"
+#include "cellular_automata.h"
+#include "thread_pool.h"
+#include "counter_rng.h"
 #include <cmath>
 #include <iostream>
 #include <algorithm>
 
+constexpr uint8_t CaveGenerator::CELL_FLOOR;
+constexpr uint8_t CaveGenerator::CELL_WALL;
+constexpr int CaveGenerator::TILE_WALL;
+
 CaveGenerator::CaveGenerator(int w, int h, unsigned int seed)
-    : width(w), height(h), rng(seed) {
-    map.resize(height, std::vector<int>(width, TILE_WALL));
+    : width(w), height(h), map(w, h, CELL_WALL), seed(seed), rng(seed),
+      pool(ThreadPool::getInstance()), noise(seed), regionsValid(false), floorTableValid(false),
+      wallDistanceValid(false),
+      cancelFlag(nullptr), stageName(""), stageFraction(0.0f) {
 }
 
 CaveGenerator::~CaveGenerator() {
 }
 
-float CaveGenerator::perlinNoise(float x, float y, int seed) {
-    // Simple hash-based pseudo-random function
-    auto hash = [](int n) {
-        n = ((n << 13) ^ n);
-        return (float)((n * (n * n * 15731 + 789221) + 1376312589) & 0x7fffffff) / 0x7fffffff;
-    };
-    
-    int xi = (int)x;
-    int yi = (int)y;
-    float xf = x - xi;
-    float yf = y - yi;
-    
-    // Get hash values for corners
-    float n00 = hash(xi + yi * 73856093 + seed);
-    float n10 = hash(xi + 1 + yi * 73856093 + seed);
-    float n01 = hash(xi + (yi + 1) * 73856093 + seed);
-    float n11 = hash(xi + 1 + (yi + 1) * 73856093 + seed);
-    
-    // Interpolate
-    float u = fade(xf);
-    float v = fade(yf);
-    
-    float nx0 = interpolate(n00, n10, u);
-    float nx1 = interpolate(n01, n11, u);
-    float result = interpolate(nx0, nx1, v);
-    
-    return result;
+void CaveGenerator::invalidateDerived() {
+    regionsValid = false;
+    floorTableValid = false;
+    wallDistanceValid = false;
+    contours.clear();
+}
+
+void CaveGenerator::ensureFloorTable() {
+    if (!floorTableValid) {
+        floorTable.build(map, CELL_FLOOR, pool);
+        floorTableValid = true;
+    }
+}
+
+int CaveGenerator::countFloor(int x0, int y0, int x1, int y1) {
+    ensureFloorTable();
+    return floorTable.count(x0, y0, x1, y1);
+}
+
+const SummedAreaTable& CaveGenerator::getFloorTable() {
+    ensureFloorTable();
+    return floorTable;
+}
+
+const DistanceField& CaveGenerator::getWallDistance() {
+    if (!wallDistanceValid) {
+        wallDistance.build(map, CELL_WALL, pool);
+        wallDistanceValid = true;
+    }
+    return wallDistance;
+}
+
+void CaveGenerator::extractContours(float tolerance) {
+    if (isCancelled()) return;
+    beginStage("contours");
+    contours.extract(map, CELL_WALL, tolerance, pool);
+    endStage();
+    std::cout << "Contours: " << contours.getLoopCount() << " loops, "
+              << contours.getPoints().size() << " points (from "
+              << contours.getRawPointCount() << ")" << std::endl;
 }
 
-float CaveGenerator::interpolate(float a, float b, float t) {
-    return a + (b - a) * t;
+void CaveGenerator::beginStage(const char *name) {
+    {
+        std::lock_guard<std::mutex> lock(progressMutex);
+        stageName = name;
+        stageFraction = -1.0f;
+        stageStart = std::chrono::steady_clock::now();
+    }
+    reportProgress(0.0f);
 }
 
-float CaveGenerator::fade(float t) {
-    return t * t * t * (t * (t * 6 - 15) + 10);
+void CaveGenerator::reportProgress(float fraction) {
+    std::lock_guard<std::mutex> lock(progressMutex);
+    // Reports from pool workers can arrive out of order; keep them monotonic
+    if (!progressCallback || fraction <= stageFraction) return;
+    stageFraction = fraction;
+    
+    GenerationProgress progress;
+    progress.stage = stageName;
+    progress.fraction = fraction;
+    progress.stageMs = std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - stageStart).count();
+    progressCallback(progress);
+}
+
+void CaveGenerator::endStage() {
+    reportProgress(1.0f);
 }
 
 void CaveGenerator::generateCellularAutomata(float fillProbability, int iterations) {
+    if (isCancelled()) return;
+    invalidateDerived();
+    beginStage("cellularAutomata");
     std::uniform_real_distribution<float> dist(0.0f, 1.0f);
     
     // Initial random fill
     for (int y = 0; y < height; y++) {
         for (int x = 0; x < width; x++) {
-            map[y][x] = dist(rng) < fillProbability ? TILE_WALL : TILE_FLOOR;
+            map.at(x, y) = dist(rng) < fillProbability ? CELL_WALL : CELL_FLOOR;
         }
     }
     
-    // Apply cellular automata rules
-    for (int iter = 0; iter < iterations; iter++) {
-        std::vector<std::vector<int>> newMap = map;
-        
-        for (int y = 1; y < height - 1; y++) {
-            for (int x = 1; x < width - 1; x++) {
-                // Count neighboring walls (including diagonals)
-                int wallCount = 0;
-                for (int dy = -1; dy <= 1; dy++) {
-                    for (int dx = -1; dx <= 1; dx++) {
-                        if (dx == 0 && dy == 0) continue;
-                        if (map[y + dy][x + dx] == TILE_WALL) {
-                            wallCount++;
-                        }
-                    }
-                }
-                
-                // Apply rules: if >= 5 neighbors are walls, become wall; otherwise floor
-                newMap[y][x] = (wallCount >= 5) ? TILE_WALL : TILE_FLOOR;
-            }
+    // Apply cellular automata rules: a cell becomes wall if >= 5 of its
+    // 8 neighbours are walls, otherwise floor
+    if (iterations > 0) {
+        caFront.pack(map, CELL_WALL, pool);
+        for (int i = 0; i < iterations && !isCancelled(); i++) {
+            ca_run(caFront, caBack, CA_RULE_NEIGHBOURS8, 1, pool);
+            reportProgress((float)(i + 1) / (iterations + 1));
         }
-        
-        map = newMap;
+        caFront.unpackInterior(map, CELL_WALL, CELL_FLOOR, pool);
     }
+    if (!isCancelled()) endStage();
 }
 
 void CaveGenerator::generatePerlinNoise(float scale, float threshold) {
-    std::cout << "Generating Perlin noise-based cave (" << width << "x" << height << ")..." << std::endl;
+    NoiseParams params;
+    params.scale = scale;
+    generatePerlinNoise(params, threshold);
+}
+
+void CaveGenerator::generatePerlinNoise(const NoiseParams &params, float threshold) {
+    if (isCancelled()) return;
+    invalidateDerived();
+    beginStage("perlinNoise");
+    std::cout << "Generating Perlin noise-based cave (" << width << "x" << height << ", "
+              << params.octaves << " octaves)..." << std::endl;
     
-    for (int y = 0; y < height; y++) {
-        if (y % 128 == 0) {
-            std::cout << "  Progress: " << (y * 100 / height) << "%" << std::endl;
-        }
-        
-        for (int x = 0; x < width; x++) {
-            float noise = perlinNoise(x * scale, y * scale, 12345);
-            map[y][x] = (noise > threshold) ? TILE_WALL : TILE_FLOOR;
+    pool->parallelFor(0, height, [this, &params, threshold](int y0, int y1) {
+        if (isCancelled()) return;
+        std::vector<float> values(width);
+        for (int y = y0; y < y1; y++) {
+            noise.fbmRow(y, 0, width, params, values.data());
+            uint8_t *row = map.row(y);
+            for (int x = 0; x < width; x++) {
+                row[x] = (values[x] > threshold) ? CELL_WALL : CELL_FLOOR;
+            }
         }
-    }
+    }, 8);
+    if (isCancelled()) return;
     
+    endStage();
     std::cout << "Perlin noise generation complete" << std::endl;
 }
 
+// Counter layout of a walk's RNG substream
+static const uint64_t WALK_START_X = 0;
+static const uint64_t WALK_START_Y = 1;
+static const uint64_t WALK_WIDTH = 2;
+static const uint64_t WALK_DIRECTIONS = 3;  // 32 two-bit directions per value
+
+// Carve one walk into a bit grid (set bit = floor). The full brush is stamped
+// once at the start; after that each move only exposes one new row or column
+// of the square brush, so only that strip is stamped.
+static void carveWalk(BitGrid &carved, const CounterRng &walkRng, int walkLength) {
+    int width = carved.getWidth();
+    int height = carved.getHeight();
+    int x = walkRng.range(WALK_START_X, 1, width - 2);
+    int y = walkRng.range(WALK_START_Y, 1, height - 2);
+    int r = walkRng.range(WALK_WIDTH, 8, 16) / 2;  // Wider tunnel variation (8-16 tiles)
+
+    // Brush cells are clipped to the interior [1, size - 2]
+    int minX = 1, maxX = width - 2, minY = 1, maxY = height - 2;
+
+    if (walkLength <= 0) return;
+    for (int cy = std::max(minY, y - r); cy <= std::min(maxY, y + r); cy++) {
+        carved.setSpan(cy, std::max(minX, x - r), std::min(maxX, x + r));
+    }
+
+    // The move made after the last step is never carved
+    uint64_t bits = 0;
+    for (int step = 0; step < walkLength - 1; step++) {
+        if ((step & 31) == 0) {
+            bits = walkRng.at(WALK_DIRECTIONS + step / 32);
+        }
+        int dir = (int)(bits & 3);
+        bits >>= 2;
+
+        // Random direction: 0=up, 1=down, 2=left, 3=right
+        switch (dir) {
+            case 0:
+                if (y == minY) break;
+                y--;
+                if (y - r >= minY) {
+                    carved.setSpan(y - r, std::max(minX, x - r), std::min(maxX, x + r));
+                }
+                break;
+            case 1:
+                if (y == maxY) break;
+                y++;
+                if (y + r <= maxY) {
+                    carved.setSpan(y + r, std::max(minX, x - r), std::min(maxX, x + r));
+                }
+                break;
+            case 2:
+                if (x == minX) break;
+                x--;
+                if (x - r >= minX) {
+                    for (int cy = std::max(minY, y - r); cy <= std::min(maxY, y + r); cy++) {
+                        carved.set(x - r, cy);
+                    }
+                }
+                break;
+            case 3:
+                if (x == maxX) break;
+                x++;
+                if (x + r <= maxX) {
+                    for (int cy = std::max(minY, y - r); cy <= std::min(maxY, y + r); cy++) {
+                        carved.set(x + r, cy);
+                    }
+                }
+                break;
+        }
+    }
+}
+
 void CaveGenerator::generateRandomWalk(int walks, int walkLength) {
+    if (isCancelled()) return;
+    invalidateDerived();
+    beginStage("randomWalk");
     std::cout << "Generating random walk cave..." << std::endl;
     
-    std::uniform_int_distribution<int> distX(1, width - 2);
-    std::uniform_int_distribution<int> distY(1, height - 2);
-    std::uniform_int_distribution<int> distDir(0, 3);
-    std::uniform_int_distribution<int> distWidth(8, 16);  // Wider tunnel variation (8-16 tiles)
-    
     // Start with all walls
-    for (int y = 0; y < height; y++) {
-        for (int x = 0; x < width; x++) {
-            map[y][x] = TILE_WALL;
-        }
+    map.fill(CELL_WALL);
+    if (width < 3 || height < 3 || walks <= 0) {
+        endStage();
+        return;
     }
     
-    // Create tunnels through random walks
-    for (int w = 0; w < walks; w++) {
-        if (w % 10 == 0) {
-            std::cout << "  Walk " << w << "/" << walks << std::endl;
-        }
-        
-        int x = distX(rng);
-        int y = distY(rng);
-        int tunnelWidth = distWidth(rng);  // Randomize tunnel width for variety
-        
-        for (int step = 0; step < walkLength; step++) {
-            // Carve out tunnel with variable width for wider passages
-            for (int wy = -tunnelWidth/2; wy <= tunnelWidth/2; wy++) {
-                for (int wx = -tunnelWidth/2; wx <= tunnelWidth/2; wx++) {
-                    int cx = x + wx;
-                    int cy = y + wy;
-                    
-                    if (cx >= 1 && cx < width - 1 && cy >= 1 && cy < height - 1) {
-                        map[cy][cx] = TILE_FLOOR;
-                    }
+    // Each walk draws from its own counter-based substream of the seed, so
+    // walks can run in any order on any thread. Groups of walks carve into
+    // separate bit grids that are OR-ed together; since carving only ever
+    // sets bits, the result is the same for any number of groups.
+    int groups = std::min(walks, pool->getThreadCount());
+    std::vector<BitGrid> carved(groups);
+    std::atomic<int> walksDone(0);
+    int reportEvery = std::max(1, walks / 32);
+    
+    pool->parallelFor(0, groups, [&](int g0, int g1) {
+        for (int g = g0; g < g1; g++) {
+            carved[g].resize(width, height);
+            int first = (int)((long long)walks * g / groups);
+            int last = (int)((long long)walks * (g + 1) / groups);
+            for (int w = first; w < last && !isCancelled(); w++) {
+                carveWalk(carved[g], CounterRng(seed, (uint64_t)w), walkLength);
+                int done = ++walksDone;
+                if (done % reportEvery == 0) {
+                    reportProgress(0.9f * done / walks);
                 }
             }
-            
-            // Random direction: 0=up, 1=down, 2=left, 3=right
-            int dir = distDir(rng);
-            switch (dir) {
-                case 0: y = std::max(1, y - 1); break;
-                case 1: y = std::min(height - 2, y + 1); break;
-                case 2: x = std::max(1, x - 1); break;
-                case 3: x = std::min(width - 2, x + 1); break;
+        }
+    });
+    if (isCancelled()) return;
+    
+    int wordsPerRow = carved[0].getWordsPerRow();
+    pool->parallelFor(0, height, [&carved, groups, wordsPerRow](int y0, int y1) {
+        for (int y = y0; y < y1; y++) {
+            uint64_t *dst = carved[0].row(y);
+            for (int g = 1; g < groups; g++) {
+                const uint64_t *src = carved[g].row(y);
+                for (int i = 0; i < wordsPerRow; i++) {
+                    dst[i] |= src[i];
+                }
             }
         }
-    }
+    }, 16);
+    carved[0].unpackInterior(map, CELL_FLOOR, CELL_WALL, pool);
     
+    endStage();
     std::cout << "Random walk generation complete" << std::endl;
 }
 
 void CaveGenerator::smoothMap(int iterations) {
+    if (isCancelled()) return;
+    invalidateDerived();
+    beginStage("smooth");
     std::cout << "Smoothing map..." << std::endl;
     
-    for (int iter = 0; iter < iterations; iter++) {
-        std::vector<std::vector<int>> newMap = map;
-        
-        for (int y = 1; y < height - 1; y++) {
-            for (int x = 1; x < width - 1; x++) {
-                int floorCount = 0;
-                int wallCount = 0;
-                
-                // Count neighbors
-                for (int dy = -1; dy <= 1; dy++) {
-                    for (int dx = -1; dx <= 1; dx++) {
-                        if (map[y + dy][x + dx] == TILE_FLOOR) {
-                            floorCount++;
-                        } else {
-                            wallCount++;
-                        }
-                    }
+    // A cell becomes floor if floors outnumber walls in its 3x3 block,
+    // i.e. if at least 5 of the 9 cells are floor
+    if (iterations > 0) {
+        caFront.pack(map, CELL_FLOOR, pool);
+        for (int i = 0; i < iterations && !isCancelled(); i++) {
+            ca_run(caFront, caBack, CA_RULE_MAJORITY9, 1, pool);
+            reportProgress((float)(i + 1) / (iterations + 1));
+        }
+        caFront.unpackInterior(map, CELL_FLOOR, CELL_WALL, pool);
+    }
+    if (isCancelled()) return;
+    
+    endStage();
+    std::cout << "Smoothing complete" << std::endl;
+}
+
+void CaveGenerator::smoothMapBox(int radius, int iterations) {
+    if (isCancelled()) return;
+    beginStage("smooth");
+    std::cout << "Smoothing map (radius " << radius << ")..." << std::endl;
+    
+    radius = std::max(1, radius);
+    for (int i = 0; i < iterations && !isCancelled(); i++) {
+        // The table is a snapshot of the previous pass, so the map can be
+        // rewritten in place
+        ensureFloorTable();
+        pool->parallelFor(1, height - 1, [this, radius](int y0, int y1) {
+            for (int y = y0; y < y1; y++) {
+                int top = std::max(0, y - radius);
+                int bottom = std::min(height - 1, y + radius);
+                const uint32_t *above = floorTable.row(top);
+                const uint32_t *below = floorTable.row(bottom + 1);
+                int rows = bottom - top + 1;
+                uint8_t *row = map.row(y);
+                for (int x = 1; x < width - 1; x++) {
+                    int left = std::max(0, x - radius);
+                    int right = std::min(width - 1, x + radius) + 1;
+                    uint32_t floors = (below[right] - below[left]) - (above[right] - above[left]);
+                    int area = (right - left) * rows;
+                    row[x] = ((int)floors * 2 > area) ? CELL_FLOOR : CELL_WALL;
                 }
-                
-                // If more floors than walls in neighborhood, become floor
-                newMap[y][x] = (floorCount > wallCount) ? TILE_FLOOR : TILE_WALL;
             }
-        }
-        
-        map = newMap;
+        }, 16);
+        invalidateDerived();
+        reportProgress((float)(i + 1) / (iterations + 1));
     }
+    if (isCancelled()) return;
     
+    endStage();
     std::cout << "Smoothing complete" << std::endl;
 }
 
 void CaveGenerator::fillSmallCaverns(int minSize) {
+    if (isCancelled()) return;
+    beginStage("fillSmallCaverns");
     std::cout << "Filling small caverns..." << std::endl;
     
-    std::vector<std::vector<bool>> visited(height, std::vector<bool>(width, false));
+    if (!regionsValid) {
+        regions.label(map, CELL_FLOOR, pool);
+        reportProgress(0.5f);
+    }
     
-    for (int y = 0; y < height; y++) {
-        for (int x = 0; x < width; x++) {
-            if (!visited[y][x] && map[y][x] == TILE_FLOOR) {
-                // Flood fill to find cavern size
-                std::vector<std::pair<int, int>> cavern;
-                std::vector<std::pair<int, int>> queue;
-                queue.push_back({x, y});
-                visited[y][x] = true;
-                
-                while (!queue.empty()) {
-                    auto pos = queue.back();
-                    queue.pop_back();
-                    int cx = pos.first;
-                    int cy = pos.second;
-                    cavern.push_back({cx, cy});
-                    
-                    // Check 4 neighbors
-                    int dx[] = {0, 0, 1, -1};
-                    int dy[] = {1, -1, 0, 0};
-                    
-                    for (int i = 0; i < 4; i++) {
-                        int nx = cx + dx[i];
-                        int ny = cy + dy[i];
-                        
-                        if (nx >= 0 && nx < width && ny >= 0 && ny < height &&
-                            !visited[ny][nx] && map[ny][nx] == TILE_FLOOR) {
-                            visited[ny][nx] = true;
-                            queue.push_back({nx, ny});
-                        }
-                    }
-                }
-                
-                // Fill if too small
-                if ((int)cavern.size() < minSize) {
-                    for (auto pos : cavern) {
-                        int cx = pos.first;
-                        int cy = pos.second;
-                        map[cy][cx] = TILE_WALL;
-                    }
-                }
+    const std::vector<CaveRegion> &found = regions.getRegions();
+    std::vector<bool> keep(found.size());
+    bool anyFilled = false;
+    for (size_t i = 0; i < found.size(); i++) {
+        keep[i] = found[i].size >= minSize;
+        anyFilled = anyFilled || !keep[i];
+    }
+    
+    // Fill runs of caverns that are too small
+    if (anyFilled) {
+        const std::vector<CellRun> &runs = regions.getRuns();
+        for (size_t i = 0; i < runs.size(); i++) {
+            if (!keep[runs[i].region]) {
+                uint8_t *row = map.row(runs[i].y);
+                std::fill(row + runs[i].x0, row + runs[i].x1 + 1, CELL_WALL);
             }
         }
+        regions.retain(keep);
+        invalidateDerived();
     }
     
+    // Only whole regions were removed, so the labels still describe the map
+    regionsValid = true;
+    
+    endStage();
     std::cout << "Cavern filling complete" << std::endl;
 }
 
-void CaveGenerator::connectAllCaverns() {
-    std::cout << "Connecting isolated caverns..." << std::endl;
+int CaveGenerator::carveTunnel(int x1, int y1, int x2, int y2, int tunnelWidth) {
+    int half = tunnelWidth / 2;
+    int carved = 0;
     
-    std::vector<std::vector<int>> caveID(height, std::vector<int>(width, -1));
-    std::vector<std::pair<int, int>> caveCenters;
-    int nextID = 0;
+    // Carve horizontal tunnel first (along y1), then vertical (along x2)
+    int startX = std::max(1, std::min(x1, x2));
+    int endX = std::min(width - 2, std::max(x1, x2));
+    if (startX <= endX) {
+        for (int ny = std::max(1, y1 - half); ny <= std::min(height - 2, y1 + half); ny++) {
+            uint8_t *row = map.row(ny);
+            std::fill(row + startX, row + endX + 1, CELL_FLOOR);
+        }
+        carved += endX - startX + 1;
+    }
     
-    // Flood fill to identify all cavern regions
-    for (int y = 0; y < height; y++) {
-        for (int x = 0; x < width; x++) {
-            if (caveID[y][x] == -1 && map[y][x] == TILE_FLOOR) {
-                // Flood fill this cavern
-                std::vector<std::pair<int, int>> queue;
-                queue.push_back({x, y});
-                caveID[y][x] = nextID;
-                
-                int minX = x, maxX = x, minY = y, maxY = y;
-                
-                while (!queue.empty()) {
-                    auto pos = queue.back();
-                    queue.pop_back();
-                    int cx = pos.first;
-                    int cy = pos.second;
-                    
-                    minX = std::min(minX, cx);
-                    maxX = std::max(maxX, cx);
-                    minY = std::min(minY, cy);
-                    maxY = std::max(maxY, cy);
-                    
-                    // Check 4 neighbors
-                    int dx[] = {0, 0, 1, -1};
-                    int dy[] = {1, -1, 0, 0};
-                    
-                    for (int i = 0; i < 4; i++) {
-                        int nx = cx + dx[i];
-                        int ny = cy + dy[i];
-                        
-                        if (nx >= 0 && nx < width && ny >= 0 && ny < height &&
-                            caveID[ny][nx] == -1 && map[ny][nx] == TILE_FLOOR) {
-                            caveID[ny][nx] = nextID;
-                            queue.push_back({nx, ny});
-                        }
-                    }
-                }
-                
-                // Store center of this cavern
-                caveCenters.push_back({(minX + maxX) / 2, (minY + maxY) / 2});
-                nextID++;
-            }
+    int startY = std::max(1, std::min(y1, y2));
+    int endY = std::min(height - 2, std::max(y1, y2));
+    int minX = std::max(1, x2 - half);
+    int maxX = std::min(width - 2, x2 + half);
+    if (minX <= maxX) {
+        for (int y = startY; y <= endY; y++) {
+            uint8_t *row = map.row(y);
+            std::fill(row + minX, row + maxX + 1, CELL_FLOOR);
         }
     }
+    carved += std::max(0, endY - startY + 1);
     
-    std::cout << "  Found " << nextID << " caverns, connecting them..." << std::endl;
+    return carved;
+}
+
+void CaveGenerator::connectAllCaverns(CavernConnection mode, int tunnelWidth) {
+    if (isCancelled()) return;
+    beginStage("connectCaverns");
+    std::cout << "Connecting isolated caverns..." << std::endl;
     
-    // Connect each cavern to the next one using simple tunnels
-    for (int i = 0; i < nextID - 1; i++) {
-        int x1 = caveCenters[i].first;
-        int y1 = caveCenters[i].second;
-        int x2 = caveCenters[i + 1].first;
-        int y2 = caveCenters[i + 1].second;
-        
-        // Carve wider tunnels: 20 tiles wide for major connections
-        int connectionWidth = 20;
-        
-        // Carve horizontal tunnel first, then vertical
-        // Horizontal
-        int startX = std::min(x1, x2);
-        int endX = std::max(x1, x2);
-        for (int x = startX; x <= endX; x++) {
-            for (int wy = -connectionWidth/2; wy <= connectionWidth/2; wy++) {
-                int ny = y1 + wy;
-                if (ny >= 1 && ny < height - 1 && x >= 1 && x < width - 1) {
-                    map[ny][x] = TILE_FLOOR;
-                }
-            }
-        }
-        
-        // Vertical
-        int startY = std::min(y1, y2);
-        int endY = std::max(y1, y2);
-        for (int y = startY; y <= endY; y++) {
-            for (int wx = -connectionWidth/2; wx <= connectionWidth/2; wx++) {
-                int nx = x2 + wx;
-                if (y >= 1 && y < height - 1 && nx >= 1 && nx < width - 1) {
-                    map[y][nx] = TILE_FLOOR;
-                }
-            }
+    if (!regionsValid) {
+        regions.label(map, CELL_FLOOR, pool);
+        reportProgress(0.5f);
+    }
+    
+    const std::vector<CaveRegion> &found = regions.getRegions();
+    int count = (int)found.size();
+    
+    std::vector<std::pair<int, int>> links;
+    if (mode == CONNECT_SPANNING_TREE) {
+        links = regions.spanningTree();
+    } else {
+        // Each cavern to the next one in scan order
+        for (int i = 0; i < count - 1; i++) {
+            links.push_back(std::make_pair(i, i + 1));
         }
     }
     
-    std::cout << "Cavern connection complete" << std::endl;
+    std::cout << "  Found " << count << " caverns, carving " << links.size() << " tunnels..." << std::endl;
+    
+    long long totalLength = 0;
+    for (size_t i = 0; i < links.size(); i++) {
+        const CaveRegion &a = found[links[i].first];
+        const CaveRegion &b = found[links[i].second];
+        totalLength += carveTunnel(a.centerX(), a.centerY(), b.centerX(), b.centerY(), tunnelWidth);
+    }
+    
+    if (!links.empty()) {
+        invalidateDerived();
+    }
+    
+    endStage();
+    std::cout << "Cavern connection complete (total tunnel length " << totalLength << ")" << std::endl;
 }
 
 void CaveGenerator::ensureTopCenterEntrance() {
+    if (isCancelled()) return;
+    invalidateDerived();
+    beginStage("entrance");
     std::cout << "Ensuring top center entrance with passage to main cavern..." << std::endl;
     
     int centerX = width / 2;
-    int topY = 5;  // A few tiles from top to avoid edge
+    int topY = ENTRANCE_TOP_Y;  // A few tiles from top to avoid edge
     
     // Carve out entrance area at top center (5x5 chamber)
     for (int y = topY - 2; y <= topY + 2; y++) {
         for (int x = centerX - 2; x <= centerX + 2; x++) {
             if (x >= 1 && x < width - 1 && y >= 1 && y < height - 1) {
-                map[y][x] = TILE_FLOOR;
+                map.at(x, y) = CELL_FLOOR;
             }
         }
     }
     
-    // Carve a passage downward from entrance until we hit an existing floor area
+    // Carve a passage downward from entrance until we hit an existing floor area.
+    // The shaft only ever looks at its own 5x5 window, so count it directly;
+    // a full-map floor table would cost far more than the few windows read.
     for (int y = topY + 3; y < height - 1; y++) {
         for (int x = centerX - 1; x <= centerX + 1; x++) {
-            map[y][x] = TILE_FLOOR;
+            map.at(x, y) = CELL_FLOOR;
             
             // Stop carving if we hit a large floor area
-            if (y > topY + 200) {
+            if (y > topY + ENTRANCE_SHAFT_DEPTH) {
                 int floorNeighbors = 0;
                 for (int dy = -2; dy <= 2; dy++) {
                     for (int dx = -2; dx <= 2; dx++) {
                         int ny = y + dy;
                         int nx = x + dx;
-                        if (nx >= 0 && nx < width && ny >= 0 && ny < height && map[ny][nx] == TILE_FLOOR) {
+                        if (nx >= 0 && nx < width && ny >= 0 && ny < height && map.at(nx, ny) == CELL_FLOOR) {
                             floorNeighbors++;
                         }
                     }
@@ -366,22 +479,110 @@ void CaveGenerator::ensureTopCenterEntrance() {
                 
                 if (floorNeighbors > 8) {
                     std::cout << "  Entrance connected to main cavern at depth " << (y - topY) << std::endl;
+                    invalidateDerived();
+                    endStage();
                     return;
                 }
             }
         }
     }
+    invalidateDerived();
+    endStage();
 }
 
-std::vector<int> CaveGenerator::getMapFlat() const {
-    std::vector<int> flat;
-    flat.reserve(width * height);
+void CaveGenerator::generateChunk(int chunkX, int chunkY, TileGrid &out) const {
+    const ChunkSettings &cs = chunkSettings;
+    int size = cs.chunkSize;
+    out.resize(size, size, CELL_WALL);
+    if (chunkX < 0 || chunkX >= cs.columns || chunkY < 0) return;
     
-    for (int y = 0; y < height; y++) {
-        for (int x = 0; x < width; x++) {
-            flat.push_back(map[y][x]);
+    // Noise over the chunk plus an apron of one cell per smoothing pass: a
+    // cell i cells in from the apron edge is exact for i iterations
+    int apron = std::max(0, cs.smoothIterations);
+    int span = size + 2 * apron;
+    int originX = chunkX * size - apron;
+    int originY = chunkY * size - apron;
+    
+    TileGrid field(span, span);
+    std::vector<float> values(span);
+    for (int y = 0; y < span; y++) {
+        noise.fbmRow(originY + y, originX, span, cs.noise, values.data());
+        uint8_t *row = field.row(y);
+        for (int x = 0; x < span; x++) {
+            row[x] = (values[x] > cs.threshold) ? CELL_WALL : CELL_FLOOR;
         }
     }
     
-    return flat;
+    BitGrid floors, scratch;
+    floors.pack(field, CELL_FLOOR);
+    ca_run(floors, scratch, CA_RULE_MAJORITY9, apron);
+    for (int y = 0; y < size; y++) {
+        uint8_t *row = out.row(y);
+        for (int x = 0; x < size; x++) {
+            row[x] = floors.get(apron + x, apron + y) ? CELL_FLOOR : CELL_WALL;
+        }
+    }
+    
+    // Fixed features, also pure functions of global coordinates
+    int mapWidth = cs.columns * size;
+    int baseX = chunkX * size;
+    int baseY = chunkY * size;
+    for (int y = 0; y < size; y++) {
+        int gy = baseY + y;
+        uint8_t *row = out.row(y);
+        if (gy == 0) {
+            std::fill(row, row + size, CELL_WALL);
+            continue;
+        }
+        if (baseX == 0) row[0] = CELL_WALL;
+        if (baseX + size == mapWidth) row[size - 1] = CELL_WALL;
+        
+        if (cs.topEntrance) {
+            int centerX = mapWidth / 2;
+            int topY = ENTRANCE_TOP_Y;
+            int half = -1;
+            if (gy >= topY - 2 && gy <= topY + 2) {
+                half = 2;   // 5x5 chamber
+            } else if (gy > topY + 2 && gy <= topY + ENTRANCE_SHAFT_DEPTH) {
+                half = 1;   // 3-wide shaft
+            }
+            for (int gx = centerX - half; half >= 0 && gx <= centerX + half; gx++) {
+                if (gx >= baseX && gx < baseX + size && gx >= 1 && gx < mapWidth - 1) {
+                    row[gx - baseX] = CELL_FLOOR;
+                }
+            }
+        }
+    }
+}
+
+TileGrid CaveGenerator::takeMap() {
+    invalidateDerived();
+    TileGrid out(std::move(map));
+    map = TileGrid();
+    return out;
+}
+
+std::vector<int> CaveGenerator::getPalette() const {
+    std::vector<int> palette(2);
+    palette[CELL_FLOOR] = TILE_FLOOR;
+    palette[CELL_WALL] = TILE_WALL;
+    return palette;
+}
+
+std::vector<int> CaveGenerator::getSolidTiles() const {
+    std::vector<int> solid = getWallEdgeTiles();
+    solid.push_back(TILE_WALL);
+    return solid;
+}
+
+std::vector<int> CaveGenerator::getWallEdgeTiles() {
+    // The grey stone block set in the top rows of the sheet, which draws a
+    // rim along each open side
+    static const int EDGE_TILES[16] = {
+        38, 43, 42, 13,     // -, N, E, NE
+        15, 10, 41, 11,     // S, NS, ES, NES
+        14, 12, 39, 8,      // W, NW, EW, NEW
+        40, 9, 36, 37       // SW, NSW, ESW, NESW
+    };
+    return std::vector<int>(EDGE_TILES, EDGE_TILES + 16);
 }
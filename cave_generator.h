@@ -3,28 +3,130 @@
 
 #include <vector>
 #include <random>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include "grid.h"
+#include "bit_grid.h"
+#include "noise.h"
+#include "cave_regions.h"
+#include "summed_area_table.h"
+#include "distance_field.h"
+#include "cave_contours.h"
+
+class ThreadPool;
+
+// How connectAllCaverns picks which caverns to join
+enum CavernConnection {
+    // Each cavern to the next one in scan order
+    CONNECT_SCAN_ORDER,
+    // Minimum spanning tree of a nearest-neighbour graph of caverns
+    CONNECT_SPANNING_TREE
+};
+
+// Settings for chunked generation: the map is a fixed number of chunks wide
+// and unbounded in depth. Each chunk is gradient noise smoothed with the
+// majority rule, computed over an apron wide enough that the result only
+// depends on global cell coordinates, so neighbouring chunks line up exactly.
+struct ChunkSettings {
+    int chunkSize;          // chunk side in tiles
+    int columns;            // map width in chunks
+    NoiseParams noise;
+    float threshold;        // noise above this becomes wall
+    int smoothIterations;
+    bool topEntrance;       // carve the entrance chamber and shaft at the top
+
+    ChunkSettings()
+        : chunkSize(64), columns(4), threshold(0.5f), smoothIterations(2),
+          topEntrance(true) {
+        noise.scale = 0.04f;
+    }
+};
+
+// Progress of one generation stage, passed to the progress callback
+struct GenerationProgress {
+    const char *stage;  // stage name, e.g. "randomWalk"
+    float fraction;     // 0 when the stage starts, 1 when it finishes
+    double stageMs;     // wall-clock time spent in the stage so far
+};
+
+// Called with progress reports; may run on pool workers, but never on two
+// threads at once
+typedef std::function<void(const GenerationProgress&)> ProgressCallback;
 
 class CaveGenerator {
 private:
     int width;
     int height;
-    std::vector<std::vector<int>> map;
+    TileGrid map;
+    unsigned int seed;
     std::mt19937 rng;
+    ThreadPool *pool;
+    GradientNoise noise;
+    ChunkSettings chunkSettings;
+    
+    // Ping-pong buffers for the cellular automata passes, kept between calls
+    BitGrid caFront;
+    BitGrid caBack;
+    
+    // Floor regions of the current map, shared by fillSmallCaverns and
+    // connectAllCaverns; only valid while regionsValid is set
+    CaveRegions regions;
+    bool regionsValid;
+    
+    // Integral image of floor cells; rebuilt on demand after the map changes
+    SummedAreaTable floorTable;
+    bool floorTableValid;
+    void ensureFloorTable();
+    
+    // Distance from each cell to the nearest wall; rebuilt on demand
+    DistanceField wallDistance;
+    bool wallDistanceValid;
+    
+    // Wall outlines from the last extractContours; emptied when the map changes
+    CaveContours contours;
+    
+    // Progress reporting and cancellation (see setProgressCallback)
+    ProgressCallback progressCallback;
+    const std::atomic<bool> *cancelFlag;
+    std::mutex progressMutex;
+    const char *stageName;
+    float stageFraction;
+    std::chrono::steady_clock::time_point stageStart;
     
-    // Perlin noise-like simplex approximation
-    float perlinNoise(float x, float y, int seed);
-    float interpolate(float a, float b, float t);
-    float fade(float t);
+    void beginStage(const char *name);
+    void reportProgress(float fraction);
+    void endStage();
+    
+    // Called by every stage that edits the map
+    void invalidateDerived();
+    
+    // L-shaped tunnel from (x1, y1) to (x2, y2); returns its length in tiles
+    int carveTunnel(int x1, int y1, int x2, int y2, int tunnelWidth);
     
 public:
     CaveGenerator(int w, int h, unsigned int seed = 12345);
     ~CaveGenerator();
     
+    // Pool used by the parallel passes (defaults to the shared pool)
+    void setThreadPool(ThreadPool *threadPool) { pool = threadPool; }
+    
+    // Receive a report when each stage starts, finishes, and at points in
+    // between. Pass nullptr to stop reporting.
+    void setProgressCallback(const ProgressCallback &callback) { progressCallback = callback; }
+    
+    // While *flag is set, stages return early and leave the map incomplete
+    void setCancelFlag(const std::atomic<bool> *flag) { cancelFlag = flag; }
+    bool isCancelled() const { return cancelFlag && cancelFlag->load(); }
+    
     // Generate cave using cellular automata
     void generateCellularAutomata(float fillProbability = 0.47f, int iterations = 5);
     
-    // Generate cave using Perlin noise
+    // Generate cave using Perlin gradient noise (fBm); cells above the
+    // threshold (noise mapped to [0, 1]) become walls
     void generatePerlinNoise(float scale = 0.05f, float threshold = 0.4f);
+    void generatePerlinNoise(const NoiseParams &params, float threshold = 0.4f);
     
     // Generate cave using random walk
     void generateRandomWalk(int walks = 50, int walkLength = 500);
@@ -32,20 +134,66 @@ public:
     // Smooth the map using cellular automata rules
     void smoothMap(int iterations = 1);
     
+    // Box-filter smoothing: a cell becomes floor if floors are the majority
+    // of the (2 * radius + 1)^2 window around it (clipped to the map). Each
+    // pass costs the same for any radius; radius 1 matches smoothMap.
+    void smoothMapBox(int radius, int iterations = 1);
+    
     // Fill small isolated caverns
     void fillSmallCaverns(int minSize = 5);
     
     // Connect all floor regions to ensure playable tunnels
-    void connectAllCaverns();
+    void connectAllCaverns(CavernConnection mode = CONNECT_SCAN_ORDER, int tunnelWidth = 20);
     
     // Ensure entrance at top center with passage to main cavern
     void ensureTopCenterEntrance();
     
-    // Get the generated map
-    const std::vector<std::vector<int>>& getMap() const { return map; }
+    // Chunked generation: produce one chunk (chunkSize x chunkSize cells) from
+    // the seed and chunk coordinates alone. Does not touch the generator's
+    // map or state, so chunks can be generated in any order and from several
+    // threads at once. Chunks outside the map columns or above row 0 are solid.
+    void setChunkSettings(const ChunkSettings &settings) { chunkSettings = settings; }
+    const ChunkSettings& getChunkSettings() const { return chunkSettings; }
+    void generateChunk(int chunkX, int chunkY, TileGrid &out) const;
+    
+    // Get the generated map (one CELL_* value per tile)
+    const TileGrid& getMap() const { return map; }
+    
+    // Floor regions from the last fillSmallCaverns/connectAllCaverns
+    const CaveRegions& getRegions() const { return regions; }
+    
+    // Floor cells in [x0, x1] x [y0, y1] (inclusive, clipped to the map) in
+    // O(1); the table is rebuilt first if a stage changed the map
+    int countFloor(int x0, int y0, int x1, int y1);
+    const SummedAreaTable& getFloorTable();
+    
+    // Euclidean distance (in tiles) from each cell to the nearest wall, with
+    // bilinear sampling between cells; rebuilt first if the map changed
+    const DistanceField& getWallDistance();
+    
+    // Trace the walls into closed polylines, simplified so no dropped vertex
+    // is more than tolerance tiles off (run after the map stages)
+    void extractContours(float tolerance = 0.5f);
+    const CaveContours& getContours() const { return contours; }
+    
+    // Move the map out (for tilemap); the generator is left empty
+    TileGrid takeMap();
+    
+    // Spritesheet tile index for each CELL_* value
+    std::vector<int> getPalette() const;
+    // Spritesheet tile indices that block movement
+    std::vector<int> getSolidTiles() const;
+    // Stone wall tiles for autotiling (see Autotiler::setEdgeTiles), indexed
+    // by which sides face open cells: N = 1, E = 2, S = 4, W = 8
+    static std::vector<int> getWallEdgeTiles();
+    
+    // Cell values stored in the map
+    static constexpr uint8_t CELL_FLOOR = 0;
+    static constexpr uint8_t CELL_WALL = 1;
     
-    // Get map as flat array (for tilemap)
-    std::vector<int> getMapFlat() const;
+    // Entrance geometry shared by ensureTopCenterEntrance and chunked mode
+    static const int ENTRANCE_TOP_Y = 5;
+    static const int ENTRANCE_SHAFT_DEPTH = 200;
     
     // Tile types (these should correspond to spritesheet indices)
     static constexpr int TILE_WALL = 30*11+24;
@@ -0,0 +1,346 @@
+#include "cave_regions.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+// Rows per labelling band; seams between bands are merged afterwards
+static const int BAND_ROWS = 64;
+
+// Union-find with the smallest run index as root, so the root of each set is
+// its first run in raster order
+static int findRoot(std::vector<int> &parent, int i) {
+    while (parent[i] != i) {
+        parent[i] = parent[parent[i]];
+        i = parent[i];
+    }
+    return i;
+}
+
+static void unite(std::vector<int> &parent, int a, int b) {
+    int ra = findRoot(parent, a);
+    int rb = findRoot(parent, b);
+    if (ra < rb) {
+        parent[rb] = ra;
+    } else if (rb < ra) {
+        parent[ra] = rb;
+    }
+}
+
+// Union the runs of row y with overlapping runs of row y - 1
+static void uniteRows(const std::vector<CellRun> &runs, const std::vector<int> &rowStart,
+                      std::vector<int> &parent, int y) {
+    int a = rowStart[y - 1], aEnd = rowStart[y];
+    int b = rowStart[y], bEnd = rowStart[y + 1];
+    while (a < aEnd && b < bEnd) {
+        if (runs[a].x0 <= runs[b].x1 && runs[b].x0 <= runs[a].x1) {
+            unite(parent, a, b);
+        }
+        // Advance whichever run ends first
+        if (runs[a].x1 < runs[b].x1) {
+            a++;
+        } else {
+            b++;
+        }
+    }
+}
+
+void CaveRegions::clear() {
+    runs.clear();
+    rowStart.clear();
+    regions.clear();
+}
+
+void CaveRegions::label(const TileGrid &map, uint8_t value, ThreadPool *pool) {
+    int width = map.getWidth();
+    int height = map.getHeight();
+    int bands = (height + BAND_ROWS - 1) / BAND_ROWS;
+    clear();
+    rowStart.assign(height + 1, 0);
+    if (height == 0) return;
+
+    // 1. Extract runs per band
+    std::vector<std::vector<CellRun>> bandRuns(bands);
+    std::function<void(int, int)> extract = [&](int b0, int b1) {
+        for (int band = b0; band < b1; band++) {
+            std::vector<CellRun> &out = bandRuns[band];
+            int yEnd = std::min(height, (band + 1) * BAND_ROWS);
+            for (int y = band * BAND_ROWS; y < yEnd; y++) {
+                const uint8_t *row = map.row(y);
+                int x = 0;
+                while (x < width) {
+                    while (x < width && row[x] != value) x++;
+                    if (x == width) break;
+                    int start = x;
+                    while (x < width && row[x] == value) x++;
+                    CellRun run = { y, start, x - 1, -1 };
+                    out.push_back(run);
+                    rowStart[y + 1]++;
+                }
+            }
+        }
+    };
+    if (pool) {
+        pool->parallelFor(0, bands, extract);
+    } else {
+        extract(0, bands);
+    }
+
+    size_t total = 0;
+    for (int band = 0; band < bands; band++) {
+        total += bandRuns[band].size();
+    }
+    runs.reserve(total);
+    for (int band = 0; band < bands; band++) {
+        runs.insert(runs.end(), bandRuns[band].begin(), bandRuns[band].end());
+        std::vector<CellRun>().swap(bandRuns[band]);
+    }
+    for (int y = 0; y < height; y++) {
+        rowStart[y + 1] += rowStart[y];
+    }
+
+    // 2. Union within each band; a band only touches its own runs
+    std::vector<int> parent(runs.size());
+    for (size_t i = 0; i < parent.size(); i++) {
+        parent[i] = (int)i;
+    }
+    std::function<void(int, int)> uniteBands = [&](int b0, int b1) {
+        for (int band = b0; band < b1; band++) {
+            int yEnd = std::min(height, (band + 1) * BAND_ROWS);
+            for (int y = band * BAND_ROWS + 1; y < yEnd; y++) {
+                uniteRows(runs, rowStart, parent, y);
+            }
+        }
+    };
+    if (pool) {
+        pool->parallelFor(0, bands, uniteBands);
+    } else {
+        uniteBands(0, bands);
+    }
+
+    // 3. Merge the seams between bands
+    for (int band = 1; band < bands; band++) {
+        uniteRows(runs, rowStart, parent, band * BAND_ROWS);
+    }
+
+    // 4. Number regions in raster order and gather their statistics
+    std::vector<double> sumX, sumY;
+    for (size_t i = 0; i < runs.size(); i++) {
+        CellRun &run = runs[i];
+        int root = findRoot(parent, (int)i);
+        if (root == (int)i) {
+            run.region = (int)regions.size();
+            CaveRegion region = { 0, run.x0, run.y, run.x1, run.y, 0.0f, 0.0f };
+            regions.push_back(region);
+            sumX.push_back(0.0);
+            sumY.push_back(0.0);
+        } else {
+            run.region = runs[root].region;
+        }
+
+        CaveRegion &region = regions[run.region];
+        int length = run.x1 - run.x0 + 1;
+        region.size += length;
+        region.minX = std::min(region.minX, run.x0);
+        region.maxX = std::max(region.maxX, run.x1);
+        region.minY = std::min(region.minY, run.y);
+        region.maxY = std::max(region.maxY, run.y);
+        sumX[run.region] += (double)length * (run.x0 + run.x1) * 0.5;
+        sumY[run.region] += (double)length * run.y;
+    }
+    for (size_t r = 0; r < regions.size(); r++) {
+        regions[r].centroidX = (float)(sumX[r] / regions[r].size);
+        regions[r].centroidY = (float)(sumY[r] / regions[r].size);
+    }
+}
+
+int CaveRegions::regionAt(int x, int y) const {
+    if (y < 0 || y + 1 >= (int)rowStart.size()) return -1;
+
+    // Last run in the row starting at or before x
+    std::vector<CellRun>::const_iterator first = runs.begin() + rowStart[y];
+    std::vector<CellRun>::const_iterator last = runs.begin() + rowStart[y + 1];
+    std::vector<CellRun>::const_iterator it = std::upper_bound(first, last, x,
+        [](int px, const CellRun &run) { return px < run.x0; });
+    if (it == first) return -1;
+    --it;
+    return (x <= it->x1) ? it->region : -1;
+}
+
+void CaveRegions::retain(const std::vector<bool> &keep) {
+    std::vector<int> remap(regions.size(), -1);
+    std::vector<CaveRegion> kept;
+    for (size_t r = 0; r < regions.size(); r++) {
+        if (keep[r]) {
+            remap[r] = (int)kept.size();
+            kept.push_back(regions[r]);
+        }
+    }
+    regions.swap(kept);
+
+    int height = (int)rowStart.size() - 1;
+    std::fill(rowStart.begin(), rowStart.end(), 0);
+    size_t out = 0;
+    for (size_t i = 0; i < runs.size(); i++) {
+        int region = remap[runs[i].region];
+        if (region < 0) continue;
+        runs[out] = runs[i];
+        runs[out].region = region;
+        rowStart[runs[out].y + 1]++;
+        out++;
+    }
+    runs.resize(out);
+    for (int y = 0; y < height; y++) {
+        rowStart[y + 1] += rowStart[y];
+    }
+}
+
+namespace {
+struct RegionEdge {
+    int weight;
+    int a;
+    int b;
+    bool operator<(const RegionEdge &other) const {
+        if (weight != other.weight) return weight < other.weight;
+        if (a != other.a) return a < other.a;
+        return b < other.b;
+    }
+};
+}
+
+// Candidate neighbours per region in the proximity graph
+static const int NEAREST_NEIGHBOURS = 4;
+
+std::vector<std::pair<int, int>> CaveRegions::spanningTree() const {
+    std::vector<std::pair<int, int>> tree;
+    int count = (int)regions.size();
+    if (count < 2) return tree;
+
+    // Spatial grid over region centres, about one region per cell
+    int minX = regions[0].centerX(), maxX = minX;
+    int minY = regions[0].centerY(), maxY = minY;
+    for (int i = 1; i < count; i++) {
+        minX = std::min(minX, regions[i].centerX());
+        maxX = std::max(maxX, regions[i].centerX());
+        minY = std::min(minY, regions[i].centerY());
+        maxY = std::max(maxY, regions[i].centerY());
+    }
+    double area = (double)(maxX - minX + 1) * (maxY - minY + 1);
+    int cellSize = std::max(1, (int)std::sqrt(area / count));
+    int gridW = (maxX - minX) / cellSize + 1;
+    int gridH = (maxY - minY) / cellSize + 1;
+
+    std::vector<int> cellStart(gridW * gridH + 1, 0);
+    std::vector<int> cellOf(count);
+    for (int i = 0; i < count; i++) {
+        int gx = (regions[i].centerX() - minX) / cellSize;
+        int gy = (regions[i].centerY() - minY) / cellSize;
+        cellOf[i] = gy * gridW + gx;
+        cellStart[cellOf[i] + 1]++;
+    }
+    for (int c = 0; c < gridW * gridH; c++) {
+        cellStart[c + 1] += cellStart[c];
+    }
+    std::vector<int> cellItems(count);
+    std::vector<int> fill(cellStart.begin(), cellStart.end() - 1);
+    for (int i = 0; i < count; i++) {
+        cellItems[fill[cellOf[i]]++] = i;
+    }
+
+    // Candidate edges: search growing rings of cells until enough neighbours
+    // are found, then one more ring so closer ones across a cell edge count
+    std::vector<RegionEdge> edges;
+    edges.reserve((size_t)count * NEAREST_NEIGHBOURS * 2);
+    std::vector<RegionEdge> candidates;
+    int maxRing = std::max(gridW, gridH);
+    for (int i = 0; i < count; i++) {
+        int gx = cellOf[i] % gridW;
+        int gy = cellOf[i] / gridW;
+        candidates.clear();
+        int stopRing = maxRing;
+        for (int ring = 0; ring <= stopRing; ring++) {
+            for (int cy = gy - ring; cy <= gy + ring; cy++) {
+                if (cy < 0 || cy >= gridH) continue;
+                bool edgeRow = (cy == gy - ring || cy == gy + ring);
+                for (int cx = gx - ring; cx <= gx + ring; cx += (edgeRow ? 1 : 2 * ring)) {
+                    if (cx >= 0 && cx < gridW) {
+                        int cell = cy * gridW + cx;
+                        for (int k = cellStart[cell]; k < cellStart[cell + 1]; k++) {
+                            int j = cellItems[k];
+                            if (j == i) continue;
+                            int weight = std::abs(regions[i].centerX() - regions[j].centerX()) +
+                                         std::abs(regions[i].centerY() - regions[j].centerY());
+                            RegionEdge edge = { weight, std::min(i, j), std::max(i, j) };
+                            candidates.push_back(edge);
+                        }
+                    }
+                    if (ring == 0) break;
+                }
+            }
+            if (stopRing == maxRing && (int)candidates.size() >= NEAREST_NEIGHBOURS) {
+                stopRing = ring + 1;
+            }
+        }
+        size_t keep = std::min(candidates.size(), (size_t)NEAREST_NEIGHBOURS);
+        std::partial_sort(candidates.begin(), candidates.begin() + keep, candidates.end());
+        edges.insert(edges.end(), candidates.begin(), candidates.begin() + keep);
+    }
+
+    // Kruskal
+    std::sort(edges.begin(), edges.end());
+    edges.erase(std::unique(edges.begin(), edges.end(),
+        [](const RegionEdge &x, const RegionEdge &y) { return x.a == y.a && x.b == y.b; }),
+        edges.end());
+    std::vector<int> parent(count);
+    for (int i = 0; i < count; i++) {
+        parent[i] = i;
+    }
+    for (size_t e = 0; e < edges.size() && (int)tree.size() < count - 1; e++) {
+        int ra = findRoot(parent, edges[e].a);
+        int rb = findRoot(parent, edges[e].b);
+        if (ra != rb) {
+            unite(parent, ra, rb);
+            tree.push_back(std::make_pair(edges[e].a, edges[e].b));
+        }
+    }
+
+    // Clusters whose nearest neighbours all lie inside the cluster can leave
+    // the graph disconnected; join the remaining trees with Prim's algorithm
+    // over one representative region per tree
+    if ((int)tree.size() < count - 1) {
+        std::vector<int> reps;
+        for (int i = 0; i < count; i++) {
+            if (findRoot(parent, i) == i) reps.push_back(i);
+        }
+        int n = (int)reps.size();
+        std::vector<int> best(n, -1);
+        std::vector<int> bestDist(n, 0);
+        std::vector<bool> inTree(n, false);
+        inTree[0] = true;
+        for (int k = 1; k < n; k++) {
+            best[k] = 0;
+            bestDist[k] = std::abs(regions[reps[k]].centerX() - regions[reps[0]].centerX()) +
+                          std::abs(regions[reps[k]].centerY() - regions[reps[0]].centerY());
+        }
+        for (int added = 1; added < n; added++) {
+            int next = -1;
+            for (int k = 0; k < n; k++) {
+                if (!inTree[k] && (next < 0 || bestDist[k] < bestDist[next])) next = k;
+            }
+            inTree[next] = true;
+            tree.push_back(std::make_pair(std::min(reps[next], reps[best[next]]),
+                                          std::max(reps[next], reps[best[next]])));
+            for (int k = 0; k < n; k++) {
+                if (inTree[k]) continue;
+                int d = std::abs(regions[reps[k]].centerX() - regions[reps[next]].centerX()) +
+                        std::abs(regions[reps[k]].centerY() - regions[reps[next]].centerY());
+                if (d < bestDist[k]) {
+                    bestDist[k] = d;
+                    best[k] = next;
+                }
+            }
+        }
+    }
+
+    return tree;
+}
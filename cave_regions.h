@@ -0,0 +1,65 @@
+#ifndef CAVE_REGIONS_H
+#define CAVE_REGIONS_H
+
+#include <vector>
+#include <utility>
+#include <cstdint>
+#include "grid.h"
+
+class ThreadPool;
+
+// Horizontal run of matching cells [x0, x1] in row y
+struct CellRun {
+    int y;
+    int x0;
+    int x1;
+    int region;
+};
+
+// One 4-connected region of matching cells
+struct CaveRegion {
+    int size;
+    int minX, minY, maxX, maxY;
+    float centroidX, centroidY;
+
+    // Centre of the bounding box
+    int centerX() const { return (minX + maxX) / 2; }
+    int centerY() const { return (minY + maxY) / 2; }
+};
+
+// Connected-component labelling over runs. Rows are split into bands that
+// are labelled in parallel with union-find, then the band seams are merged.
+// Regions are numbered in raster order of their first cell, the same order
+// a row-by-row flood fill would find them in.
+class CaveRegions {
+private:
+    std::vector<CellRun> runs;      // sorted by row, then x
+    std::vector<int> rowStart;      // first run of each row, height + 1 entries
+    std::vector<CaveRegion> regions;
+
+public:
+    // Label all 4-connected regions of cells equal to value
+    void label(const TileGrid &map, uint8_t value, ThreadPool *pool = nullptr);
+
+    void clear();
+
+    const std::vector<CaveRegion>& getRegions() const { return regions; }
+    const std::vector<CellRun>& getRuns() const { return runs; }
+    int getRegionCount() const { return (int)regions.size(); }
+
+    // Region containing cell (x, y), or -1
+    int regionAt(int x, int y) const;
+
+    // Minimum spanning tree over region bounding-box centres, using Manhattan
+    // distance (the length of an L-shaped tunnel). Candidate edges come from
+    // a spatial grid: each region links to its nearest few neighbours, so the
+    // cost depends on the region count, not the map area. Returns pairs of
+    // region indices; the tree always spans every region.
+    std::vector<std::pair<int, int>> spanningTree() const;
+
+    // Drop regions whose keep flag is false (their runs go too); survivors
+    // are renumbered in their existing order
+    void retain(const std::vector<bool> &keep);
+};
+
+#endif // CAVE_REGIONS_H
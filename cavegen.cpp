@@ -0,0 +1,142 @@
+// cavegen: run a generation pipeline without a window and report timing.
+//
+//   cavegen [--config FILE] [--size W H] [--seed N] [--threads N]
+//           [--repeat N] [--json FILE] [--pgm FILE] [--map FILE] [--verbose]
+//
+// Timing of the last run goes to --json (or stdout) as JSON; --pgm writes
+// the resulting map as a greyscale image for a quick look, --map as a
+// chunked map file the game can stream (game --map FILE).
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <cstdlib>
+#include <memory>
+#include <algorithm>
+#include "cave_generator.h"
+#include "generation_pipeline.h"
+#include "thread_pool.h"
+#include "tilemap_file.h"
+
+static void printUsage() {
+    std::cerr << "Usage: cavegen [--config FILE] [--size W H] [--seed N] [--threads N]\n"
+              << "               [--repeat N] [--json FILE] [--pgm FILE] [--map FILE] [--verbose]" << std::endl;
+}
+
+static bool writePgm(const std::string &path, const TileGrid &map) {
+    std::ofstream out(path.c_str(), std::ios::binary);
+    if (!out) {
+        std::cerr << "Cannot write " << path << std::endl;
+        return false;
+    }
+    out << "P5\n" << map.getWidth() << " " << map.getHeight() << "\n255\n";
+    for (int y = 0; y < map.getHeight(); y++) {
+        const uint8_t *row = map.row(y);
+        for (int x = 0; x < map.getWidth(); x++) {
+            out.put(row[x] == CaveGenerator::CELL_FLOOR ? (char)255 : (char)0);
+        }
+    }
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    GenerationPipeline pipeline;
+    pipeline.parse(GenerationPipeline::DEFAULT_CONFIG);
+
+    std::string jsonPath;
+    std::string pgmPath;
+    std::string mapPath;
+    int threads = 0;
+    int repeat = 1;
+    bool verbose = false;
+    int width = -1, height = -1;
+    long long seed = -1;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--config" && hasValue) {
+            if (!pipeline.loadFile(argv[++i])) return 1;
+        } else if (arg == "--size" && i + 2 < argc) {
+            width = std::atoi(argv[++i]);
+            height = std::atoi(argv[++i]);
+        } else if (arg == "--seed" && hasValue) {
+            seed = std::atoll(argv[++i]);
+        } else if (arg == "--threads" && hasValue) {
+            threads = std::atoi(argv[++i]);
+        } else if (arg == "--repeat" && hasValue) {
+            repeat = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--json" && hasValue) {
+            jsonPath = argv[++i];
+        } else if (arg == "--pgm" && hasValue) {
+            pgmPath = argv[++i];
+        } else if (arg == "--map" && hasValue) {
+            mapPath = argv[++i];
+        } else if (arg == "--verbose") {
+            verbose = true;
+        } else {
+            printUsage();
+            return 1;
+        }
+    }
+
+    // Command-line size and seed override the config
+    if (width > 0 || height > 0) {
+        if (width < 3 || height < 3) {
+            std::cerr << "Map size must be at least 3x3" << std::endl;
+            return 1;
+        }
+        pipeline.setSize(width, height);
+    }
+    if (seed >= 0) {
+        pipeline.setSeed((unsigned int)seed);
+    }
+
+    std::unique_ptr<ThreadPool> ownPool;
+    if (threads > 0) {
+        ownPool.reset(new ThreadPool(threads));
+    }
+    ThreadPool *pool = ownPool ? ownPool.get() : ThreadPool::getInstance();
+
+    // The stages log to std::cout; keep it quiet unless asked
+    std::ostringstream discard;
+    std::streambuf *coutBuf = std::cout.rdbuf();
+    if (!verbose) {
+        std::cout.rdbuf(discard.rdbuf());
+    }
+
+    // The report includes how many cells each stage changed
+    pipeline.setCountChanges(true);
+    TileGrid result;
+    std::vector<int> palette;
+    for (int r = 0; r < repeat; r++) {
+        CaveGenerator generator(pipeline.getWidth(), pipeline.getHeight(), pipeline.getSeed());
+        generator.setThreadPool(pool);
+        pipeline.run(generator);
+        discard.str("");
+        if (r == repeat - 1) {
+            result = generator.takeMap();
+            palette = generator.getPalette();
+        }
+    }
+    std::cout.rdbuf(coutBuf);
+
+    if (jsonPath.empty()) {
+        pipeline.writeStatsJson(std::cout);
+    } else {
+        std::ofstream out(jsonPath.c_str());
+        if (!out) {
+            std::cerr << "Cannot write " << jsonPath << std::endl;
+            return 1;
+        }
+        pipeline.writeStatsJson(out);
+    }
+
+    if (!pgmPath.empty() && !writePgm(pgmPath, result)) {
+        return 1;
+    }
+    if (!mapPath.empty() && !TilemapFile::save(mapPath, result, palette)) {
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,187 @@
+#include "cellular_automata.h"
+#include "thread_pool.h"
+#include "cpu_features.h"
+#include <utility>
+
+#ifdef HAVE_AVX2_KERNELS
+#include <immintrin.h>
+#endif
+
+// Count-of-nine kernel shared by both rules.
+//
+// Each of the three rows contributes its left neighbour (x-1), centre and
+// right neighbour (x+1) bit planes. The three rows are first summed per
+// column into a 2-bit value (s1:s0), then the three columns are summed into
+// a 4-bit total (b3:b2:t1:p0) with full adders. ">= 5" then reduces to
+// b3 | (b2 & (t1 | p0)); excluding the centre cell turns the low term into
+// (p0 & ~centre), since removing it from the total means ">= 6" when set.
+static inline uint64_t majority(uint64_t a, uint64_t b, uint64_t c) {
+    return (a & b) | (c & (a ^ b));
+}
+
+static inline uint64_t stepWord(const uint64_t *up, const uint64_t *mid, const uint64_t *down,
+                                int j, bool excludeCentre) {
+    uint64_t uC = up[j], mC = mid[j], dC = down[j];
+    uint64_t uL = (uC << 1) | (up[j - 1] >> 63);
+    uint64_t mL = (mC << 1) | (mid[j - 1] >> 63);
+    uint64_t dL = (dC << 1) | (down[j - 1] >> 63);
+    uint64_t uR = (uC >> 1) | (up[j + 1] << 63);
+    uint64_t mR = (mC >> 1) | (mid[j + 1] << 63);
+    uint64_t dR = (dC >> 1) | (down[j + 1] << 63);
+
+    uint64_t l0 = uL ^ mL ^ dL, l1 = majority(uL, mL, dL);
+    uint64_t c0 = uC ^ mC ^ dC, c1 = majority(uC, mC, dC);
+    uint64_t r0 = uR ^ mR ^ dR, r1 = majority(uR, mR, dR);
+
+    uint64_t p0 = l0 ^ c0 ^ r0;
+    uint64_t carry = majority(l0, c0, r0);
+    uint64_t h1 = l1 ^ c1 ^ r1;
+    uint64_t h2 = majority(l1, c1, r1);
+    uint64_t t1 = h1 ^ carry;
+    uint64_t k = h1 & carry;
+    uint64_t b2 = h2 ^ k;
+    uint64_t b3 = h2 & k;
+
+    uint64_t low = excludeCentre ? (p0 & ~mC) : p0;
+    return b3 | (b2 & (t1 | low));
+}
+
+#ifdef HAVE_AVX2_KERNELS
+__attribute__((target("avx2")))
+static inline __m256i majority256(__m256i a, __m256i b, __m256i c) {
+    return _mm256_or_si256(_mm256_and_si256(a, b), _mm256_and_si256(c, _mm256_xor_si256(a, b)));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i xor3(__m256i a, __m256i b, __m256i c) {
+    return _mm256_xor_si256(_mm256_xor_si256(a, b), c);
+}
+
+// Same as stepWord, four words at a time. Words [jBegin, jEnd) must lie fully
+// inside the interior of the row.
+__attribute__((target("avx2")))
+static void stepRowAvx2(const uint64_t *up, const uint64_t *mid, const uint64_t *down,
+                        uint64_t *out, int jBegin, int jEnd, bool excludeCentre) {
+    for (int j = jBegin; j + 4 <= jEnd; j += 4) {
+        const __m256i *pu = (const __m256i *)(up + j);
+        const __m256i *pm = (const __m256i *)(mid + j);
+        const __m256i *pd = (const __m256i *)(down + j);
+        __m256i uC = _mm256_loadu_si256(pu);
+        __m256i mC = _mm256_loadu_si256(pm);
+        __m256i dC = _mm256_loadu_si256(pd);
+        __m256i uL = _mm256_or_si256(_mm256_slli_epi64(uC, 1),
+                                     _mm256_srli_epi64(_mm256_loadu_si256((const __m256i *)(up + j - 1)), 63));
+        __m256i mL = _mm256_or_si256(_mm256_slli_epi64(mC, 1),
+                                     _mm256_srli_epi64(_mm256_loadu_si256((const __m256i *)(mid + j - 1)), 63));
+        __m256i dL = _mm256_or_si256(_mm256_slli_epi64(dC, 1),
+                                     _mm256_srli_epi64(_mm256_loadu_si256((const __m256i *)(down + j - 1)), 63));
+        __m256i uR = _mm256_or_si256(_mm256_srli_epi64(uC, 1),
+                                     _mm256_slli_epi64(_mm256_loadu_si256((const __m256i *)(up + j + 1)), 63));
+        __m256i mR = _mm256_or_si256(_mm256_srli_epi64(mC, 1),
+                                     _mm256_slli_epi64(_mm256_loadu_si256((const __m256i *)(mid + j + 1)), 63));
+        __m256i dR = _mm256_or_si256(_mm256_srli_epi64(dC, 1),
+                                     _mm256_slli_epi64(_mm256_loadu_si256((const __m256i *)(down + j + 1)), 63));
+
+        __m256i l0 = xor3(uL, mL, dL), l1 = majority256(uL, mL, dL);
+        __m256i c0 = xor3(uC, mC, dC), c1 = majority256(uC, mC, dC);
+        __m256i r0 = xor3(uR, mR, dR), r1 = majority256(uR, mR, dR);
+
+        __m256i p0 = xor3(l0, c0, r0);
+        __m256i carry = majority256(l0, c0, r0);
+        __m256i h1 = xor3(l1, c1, r1);
+        __m256i h2 = majority256(l1, c1, r1);
+        __m256i t1 = _mm256_xor_si256(h1, carry);
+        __m256i k = _mm256_and_si256(h1, carry);
+        __m256i b2 = _mm256_xor_si256(h2, k);
+        __m256i b3 = _mm256_and_si256(h2, k);
+
+        __m256i low = excludeCentre ? _mm256_andnot_si256(mC, p0) : p0;
+        __m256i result = _mm256_or_si256(b3, _mm256_and_si256(b2, _mm256_or_si256(t1, low)));
+        _mm256_storeu_si256((__m256i *)(out + j), result);
+    }
+}
+#endif
+
+bool ca_avx2_available() {
+    return cpu_has_avx2();
+}
+
+void ca_step(const BitGrid &src, BitGrid &dst, CaRule rule, int rowBegin, int rowEnd) {
+    int width = src.getWidth();
+    int height = src.getHeight();
+    int words = src.getWordsPerRow();
+    if (width < 3 || height < 3) return;
+
+    bool excludeCentre = (rule == CA_RULE_NEIGHBOURS8);
+    int lastWord = words - 1;
+
+    // Interior masks for the first and last word: x = 0 and x = width - 1
+    // keep their old value, padding bits past the width stay clear
+    uint64_t firstMask = ~(uint64_t)1;
+    uint64_t lastMask = ((width - 1) & 63) ? (~(uint64_t)0 >> (64 - ((width - 1) & 63))) : 0;
+    if (lastWord == 0) {
+        firstMask &= lastMask;
+    }
+
+    rowBegin = std::max(rowBegin, 1);
+    rowEnd = std::min(rowEnd, height - 1);
+    bool useAvx2 = ca_avx2_available();
+
+    for (int y = rowBegin; y < rowEnd; y++) {
+        const uint64_t *up = src.row(y - 1);
+        const uint64_t *mid = src.row(y);
+        const uint64_t *down = src.row(y + 1);
+        uint64_t *out = dst.row(y);
+
+        // Edge words (partially border) with masking
+        out[0] = (stepWord(up, mid, down, 0, excludeCentre) & firstMask) | (mid[0] & ~firstMask);
+        if (lastWord > 0) {
+            out[lastWord] = (stepWord(up, mid, down, lastWord, excludeCentre) & lastMask) |
+                            (mid[lastWord] & ~lastMask);
+        }
+
+        // Fully interior words
+        int j = 1;
+#ifdef HAVE_AVX2_KERNELS
+        if (useAvx2) {
+            int vecEnd = 1 + ((lastWord - 1) / 4) * 4;
+            stepRowAvx2(up, mid, down, out, 1, vecEnd, excludeCentre);
+            j = vecEnd;
+        }
+#else
+        (void)useAvx2;
+#endif
+        for (; j < lastWord; j++) {
+            out[j] = stepWord(up, mid, down, j, excludeCentre);
+        }
+    }
+}
+
+static void copyBorderRows(const BitGrid &src, BitGrid &dst) {
+    int words = src.getWordsPerRow();
+    int last = src.getHeight() - 1;
+    std::copy(src.row(0), src.row(0) + words, dst.row(0));
+    std::copy(src.row(last), src.row(last) + words, dst.row(last));
+}
+
+void ca_run(BitGrid &cur, BitGrid &scratch, CaRule rule, int iterations, ThreadPool *pool) {
+    if (iterations <= 0 || cur.getWidth() < 3 || cur.getHeight() < 3) return;
+
+    if (scratch.getWidth() != cur.getWidth() || scratch.getHeight() != cur.getHeight()) {
+        scratch.resize(cur.getWidth(), cur.getHeight());
+    }
+    copyBorderRows(cur, scratch);
+
+    for (int iter = 0; iter < iterations; iter++) {
+        if (pool) {
+            const BitGrid &src = cur;
+            BitGrid &dst = scratch;
+            pool->parallelFor(1, cur.getHeight() - 1, [&src, &dst, rule](int y0, int y1) {
+                ca_step(src, dst, rule, y0, y1);
+            }, 16);
+        } else {
+            ca_step(cur, scratch, rule, 1, cur.getHeight() - 1);
+        }
+        std::swap(cur, scratch);
+    }
+}
@@ -0,0 +1,32 @@
+#ifndef CELLULAR_AUTOMATA_H
+#define CELLULAR_AUTOMATA_H
+
+#include "bit_grid.h"
+
+class ThreadPool;
+
+// Bit-parallel cellular automata kernels. Neighbour counts are computed for
+// 64 cells at a time with a bit-sliced adder over shifted row words; an AVX2
+// variant processes 256 cells per step and is selected at runtime.
+enum CaRule {
+    // Set if at least 5 of the 9 cells in the 3x3 block (centre included) are set
+    CA_RULE_MAJORITY9,
+    // Set if at least 5 of the 8 neighbours (centre excluded) are set
+    CA_RULE_NEIGHBOURS8
+};
+
+// Compute rows [rowBegin, rowEnd) of dst from src. Only cells inside the one
+// cell border are updated; callers keep border cells identical in both grids.
+void ca_step(const BitGrid &src, BitGrid &dst, CaRule rule, int rowBegin, int rowEnd);
+
+// Run the rule for the given number of iterations, ping-ponging between cur
+// and scratch; the result ends up in cur. Each iteration splits the rows into
+// bands across the pool (if given). Every cell only reads the previous
+// generation, so the result does not depend on the number of threads.
+void ca_run(BitGrid &cur, BitGrid &scratch, CaRule rule, int iterations,
+            ThreadPool *pool = nullptr);
+
+// True if the AVX2 kernel is in use on this CPU
+bool ca_avx2_available();
+
+#endif // CELLULAR_AUTOMATA_H
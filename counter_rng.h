@@ -0,0 +1,41 @@
+#ifndef COUNTER_RNG_H
+#define COUNTER_RNG_H
+
+#include <cstdint>
+
+// Counter-based random numbers: value i of a stream is a pure function of
+// (seed, stream, i), so independent streams can be consumed in any order or
+// on any thread and still give the same results.
+class CounterRng {
+private:
+    uint64_t key;
+
+    // SplitMix64 finalizer
+    static uint64_t mix(uint64_t z) {
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        return z ^ (z >> 31);
+    }
+
+public:
+    CounterRng(uint64_t seed, uint64_t stream)
+        : key(mix(mix(seed) + stream * 0x9e3779b97f4a7c15ULL)) {}
+
+    // 64 random bits for the given counter
+    uint64_t at(uint64_t counter) const {
+        return mix(key + (counter + 1) * 0x9e3779b97f4a7c15ULL);
+    }
+
+    // Integer in [lo, hi] (multiply-shift; bias is negligible for small ranges)
+    int range(uint64_t counter, int lo, int hi) const {
+        uint64_t span = (uint64_t)(hi - lo) + 1;
+        return lo + (int)(((at(counter) >> 32) * span) >> 32);
+    }
+
+    // Float in [0, 1)
+    float uniform(uint64_t counter) const {
+        return (float)(at(counter) >> 40) * (1.0f / 16777216.0f);
+    }
+};
+
+#endif // COUNTER_RNG_H
@@ -0,0 +1,20 @@
+#ifndef CPU_FEATURES_H
+#define CPU_FEATURES_H
+
+// Runtime ISA detection for kernels that carry an AVX2 variant. Kernels are
+// compiled with __attribute__((target("avx2"))) so the rest of the build
+// stays at the baseline ISA.
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define HAVE_AVX2_KERNELS 1
+#endif
+
+inline bool cpu_has_avx2() {
+#ifdef HAVE_AVX2_KERNELS
+    static const bool available = (__builtin_cpu_init(), __builtin_cpu_supports("avx2") != 0);
+    return available;
+#else
+    return false;
+#endif
+}
+
+#endif // CPU_FEATURES_H
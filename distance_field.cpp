@@ -0,0 +1,154 @@
+#include "distance_field.h"
+#include "thread_pool.h"
+#include <cmath>
+#include <vector>
+
+// Breakpoint between two parabolas of the envelope, kept as an exact
+// fraction num / den (den > 0) so no division is needed
+struct Breakpoint {
+    long long num;
+    long long den;
+};
+
+// Lower envelope of the parabolas (x - q)^2 + f[q] for q in [a, b],
+// evaluated at a < x < b; z[k] is where parabola v[k] takes over from v[k - 1]
+static void envelopeSegment(const int *f, int a, int b, float *out,
+                            std::vector<int> &v, std::vector<Breakpoint> &z) {
+    int k = 0;
+    v[0] = a;
+    for (int q = a + 1; q <= b; q++) {
+        long long fq = (long long)f[q] + (long long)q * q;
+        Breakpoint s;
+        for (;;) {
+            int p = v[k];
+            s.num = fq - ((long long)f[p] + (long long)p * p);
+            s.den = 2LL * (q - p);
+            // Pop v[k] while q overtakes it no later than v[k] took over
+            if (k == 0 || s.num * z[k].den > z[k].num * s.den) break;
+            k--;
+        }
+        k++;
+        v[k] = q;
+        z[k] = s;
+    }
+
+    int j = 0;
+    for (int x = a + 1; x < b; x++) {
+        while (j < k && z[j + 1].num < (long long)x * z[j + 1].den) j++;
+        long long dx = x - v[j];
+        out[x] = (float)(dx * dx + f[v[j]]);
+    }
+}
+
+// Squared distance to the nearest wall for one row. f holds the squared
+// vertical distances at 1..n, with frame walls (0) at 0 and n + 1; out is
+// indexed the same way. A wall beats every parabola from beyond it, so each
+// run of non-wall cells only needs the parabolas between the walls around it.
+static void envelopeRow(const int *f, int n, float *out,
+                        std::vector<int> &v, std::vector<Breakpoint> &z) {
+    v.resize(n + 2);
+    z.resize(n + 2);
+    int a = 0;
+    while (a <= n) {
+        int b = a + 1;
+        while (f[b] != 0) b++;
+        if (b > a + 1) {
+            envelopeSegment(f, a, b, out, v, z);
+        }
+        out[b] = 0.0f;
+        a = b;
+    }
+}
+
+void DistanceField::build(const TileGrid &map, uint8_t wallValue, ThreadPool *pool) {
+    int width = map.getWidth();
+    int height = map.getHeight();
+    distance.resize(width, height);
+    if (width == 0 || height == 0) return;
+
+    // Vertical pass: distance to the nearest wall in the same column, with
+    // frame walls above and below the map. Bands of columns walk the rows
+    // top to bottom and back so memory access stays contiguous.
+    Grid<int> vertical(width, height);
+    auto columnPass = [&map, &vertical, height, wallValue](int x0, int x1) {
+        // The frame row above puts non-wall cells of row 0 at distance 1
+        const uint8_t *src = map.row(0);
+        int *dst = vertical.row(0);
+        for (int x = x0; x < x1; x++) {
+            dst[x] = (src[x] == wallValue) ? 0 : 1;
+        }
+        for (int y = 1; y < height; y++) {
+            src = map.row(y);
+            const int *above = vertical.row(y - 1);
+            dst = vertical.row(y);
+            for (int x = x0; x < x1; x++) {
+                dst[x] = (src[x] == wallValue) ? 0 : above[x] + 1;
+            }
+        }
+        // Likewise the frame row below for the last row, then sweep back up
+        dst = vertical.row(height - 1);
+        for (int x = x0; x < x1; x++) {
+            dst[x] = std::min(dst[x], 1);
+        }
+        for (int y = height - 2; y >= 0; y--) {
+            const int *below = vertical.row(y + 1);
+            dst = vertical.row(y);
+            for (int x = x0; x < x1; x++) {
+                dst[x] = std::min(dst[x], below[x] + 1);
+            }
+        }
+    };
+
+    // Horizontal pass: exact 2D distance from the column distances
+    auto rowPass = [this, &vertical, width](int y0, int y1) {
+        std::vector<int> f(width + 2, 0);
+        std::vector<float> squared(width + 2);
+        std::vector<int> v;
+        std::vector<Breakpoint> z;
+        for (int y = y0; y < y1; y++) {
+            const int *g = vertical.row(y);
+            for (int x = 0; x < width; x++) {
+                f[x + 1] = g[x] * g[x];
+            }
+            envelopeRow(f.data(), width, squared.data(), v, z);
+            float *out = distance.row(y);
+            for (int x = 0; x < width; x++) {
+                out[x] = std::sqrt(squared[x + 1]);
+            }
+        }
+    };
+
+    if (pool) {
+        pool->parallelFor(0, width, columnPass, 256);
+        pool->parallelFor(0, height, rowPass, 16);
+    } else {
+        columnPass(0, width);
+        rowPass(0, height);
+    }
+}
+
+float DistanceField::sample(float x, float y) const {
+    int width = distance.getWidth();
+    int height = distance.getHeight();
+    if (width == 0 || height == 0) return 0.0f;
+
+    // Interpolate between cell centres, clamped at the map edge
+    float u = std::min(std::max(x - 0.5f, 0.0f), (float)(width - 1));
+    float v = std::min(std::max(y - 0.5f, 0.0f), (float)(height - 1));
+    int x0 = std::min((int)u, width - 2 < 0 ? 0 : width - 2);
+    int y0 = std::min((int)v, height - 2 < 0 ? 0 : height - 2);
+    int x1 = std::min(x0 + 1, width - 1);
+    int y1 = std::min(y0 + 1, height - 1);
+    float fx = u - x0;
+    float fy = v - y0;
+
+    float top = distance.at(x0, y0) + fx * (distance.at(x1, y0) - distance.at(x0, y0));
+    float bottom = distance.at(x0, y1) + fx * (distance.at(x1, y1) - distance.at(x0, y1));
+    return top + fy * (bottom - top);
+}
+
+void DistanceField::gradient(float x, float y, float &gx, float &gy) const {
+    const float h = 0.5f;
+    gx = (sample(x + h, y) - sample(x - h, y)) / (2.0f * h);
+    gy = (sample(x, y + h) - sample(x, y - h)) / (2.0f * h);
+}
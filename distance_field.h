@@ -0,0 +1,42 @@
+#ifndef DISTANCE_FIELD_H
+#define DISTANCE_FIELD_H
+
+#include "grid.h"
+
+class ThreadPool;
+
+// Exact Euclidean distance, in tiles, from every cell centre to the centre
+// of the nearest wall cell. Cells outside the map count as walls, so the
+// field also keeps things away from the map edge. Built with the separable
+// lower-envelope algorithm (Felzenszwalb & Huttenlocher): a vertical pass
+// over column bands, then a parabola envelope per row. Both passes are
+// linear and run in parallel.
+class DistanceField {
+private:
+    Grid<float> distance;
+
+public:
+    // Cells equal to wallValue are walls (distance 0)
+    void build(const TileGrid &map, uint8_t wallValue, ThreadPool *pool = nullptr);
+    void clear() { distance.resize(0, 0); }
+
+    int getWidth() const { return distance.getWidth(); }
+    int getHeight() const { return distance.getHeight(); }
+    bool empty() const { return distance.empty(); }
+
+    // Distance at a cell; 0 outside the map
+    float at(int x, int y) const {
+        return distance.inBounds(x, y) ? distance.at(x, y) : 0.0f;
+    }
+    const float* row(int y) const { return distance.row(y); }
+
+    // Bilinear sample at a point in tile units (cell (x, y) spans
+    // [x, x + 1) x [y, y + 1), its centre is at (x + 0.5, y + 0.5))
+    float sample(float x, float y) const;
+
+    // Gradient of the sampled field: points away from the nearest walls,
+    // roughly unit length away from ridges
+    void gradient(float x, float y, float &gx, float &gy) const;
+};
+
+#endif // DISTANCE_FIELD_H
@@ -39,6 +39,8 @@ bool Engine::init(const char *title, int width, int height) {
         return false;
     }
 
+    // Render targets are not required: the tilemap checks
+    // SDL_RenderTargetSupported and draws without them when they are missing
     renderer = SDL_CreateRenderer(
         window, -1,
         SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC
@@ -0,0 +1,76 @@
+#include "generation_job.h"
+
+GenerationJob::GenerationJob(CaveGenerator &generator, const Recipe &recipe,
+                             const ProgressCallback &onProgress)
+    : generator(generator), onProgress(onProgress), cancelled(false), done(false),
+      startTime(std::chrono::steady_clock::now()), totalMs(0.0) {
+    latest.stage = "";
+    latest.fraction = 0.0f;
+    latest.stageMs = 0.0;
+
+    generator.setCancelFlag(&cancelled);
+    generator.setProgressCallback([this](const GenerationProgress &progress) {
+        record(progress);
+    });
+    worker = std::thread(&GenerationJob::run, this, recipe);
+}
+
+GenerationJob::~GenerationJob() {
+    cancel();
+    wait();
+}
+
+void GenerationJob::run(Recipe recipe) {
+    recipe(generator);
+
+    generator.setProgressCallback(nullptr);
+    generator.setCancelFlag(nullptr);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        totalMs = std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - startTime).count();
+    }
+    done.store(true);
+}
+
+void GenerationJob::record(const GenerationProgress &progress) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        latest = progress;
+        if (progress.fraction >= 1.0f) {
+            finished.push_back(progress);
+        }
+    }
+    if (onProgress) {
+        onProgress(progress);
+    }
+}
+
+void GenerationJob::cancel() {
+    cancelled.store(true);
+}
+
+void GenerationJob::wait() {
+    if (worker.joinable()) {
+        worker.join();
+    }
+}
+
+GenerationProgress GenerationJob::getProgress() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return latest;
+}
+
+double GenerationJob::getElapsedMs() const {
+    if (done.load()) {
+        std::lock_guard<std::mutex> lock(mutex);
+        return totalMs;
+    }
+    return std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - startTime).count();
+}
+
+std::vector<GenerationProgress> GenerationJob::getFinishedStages() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return finished;
+}
@@ -0,0 +1,62 @@
+#ifndef GENERATION_JOB_H
+#define GENERATION_JOB_H
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "cave_generator.h"
+
+// Runs a generation recipe on a background thread. The generator belongs to
+// the job until isDone() returns true; other threads must not touch it
+// before then.
+class GenerationJob {
+public:
+    typedef std::function<void(CaveGenerator&)> Recipe;
+
+    // Starts recipe(generator) right away. onProgress, if given, is called
+    // on the generating thread with every progress report.
+    GenerationJob(CaveGenerator &generator, const Recipe &recipe,
+                  const ProgressCallback &onProgress = ProgressCallback());
+    // Cancels the job and waits for the worker to stop
+    ~GenerationJob();
+
+    GenerationJob(const GenerationJob&) = delete;
+    GenerationJob& operator=(const GenerationJob&) = delete;
+
+    // Ask the running stage to stop at its next check; the map is then
+    // incomplete and the remaining stages are skipped
+    void cancel();
+    bool isCancelled() const { return cancelled.load(); }
+    bool isDone() const { return done.load(); }
+    void wait();
+
+    // Latest report and wall-clock time since the job started (frozen once
+    // the job is done)
+    GenerationProgress getProgress() const;
+    double getElapsedMs() const;
+
+    // Final report (fraction 1) of every stage finished so far
+    std::vector<GenerationProgress> getFinishedStages() const;
+
+private:
+    CaveGenerator &generator;
+    ProgressCallback onProgress;
+    std::atomic<bool> cancelled;
+    std::atomic<bool> done;
+    std::chrono::steady_clock::time_point startTime;
+    double totalMs;
+
+    mutable std::mutex mutex;
+    GenerationProgress latest;
+    std::vector<GenerationProgress> finished;
+
+    std::thread worker;
+
+    void run(Recipe recipe);
+    void record(const GenerationProgress &progress);
+};
+
+#endif // GENERATION_JOB_H
@@ -0,0 +1,322 @@
+#include "generation_pipeline.h"
+#include "cave_generator.h"
+#include "alloc_stats.h"
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+const char *GenerationPipeline::DEFAULT_CONFIG =
+    "size 256 1024\n"
+    "seed 42\n"
+    "randomWalk walks=300 length=3000\n"
+    "smooth iterations=3\n"
+    "fillSmallCaverns minSize=50\n"
+    "connectCaverns mode=spanningTree\n"
+    "entrance\n";
+
+// Settings each stage accepts
+struct StageSpec {
+    const char *name;
+    const char *keys[8];
+};
+
+static const StageSpec STAGE_SPECS[] = {
+    { "cellularAutomata", { "fill", "iterations" } },
+    { "perlinNoise", { "scale", "threshold", "octaves", "lacunarity", "gain", "warp", "warpScale" } },
+    { "randomWalk", { "walks", "length" } },
+    { "smooth", { "iterations", "radius" } },
+    { "fillSmallCaverns", { "minSize" } },
+    { "connectCaverns", { "mode", "width" } },
+    { "entrance", { } },
+    { "contours", { "tolerance" } },
+};
+
+static const StageSpec *findSpec(const std::string &name) {
+    for (size_t i = 0; i < sizeof(STAGE_SPECS) / sizeof(STAGE_SPECS[0]); i++) {
+        if (name == STAGE_SPECS[i].name) return &STAGE_SPECS[i];
+    }
+    return nullptr;
+}
+
+static bool isNumber(const std::string &value) {
+    if (value.empty()) return false;
+    char *end = nullptr;
+    std::strtod(value.c_str(), &end);
+    return *end == '\0';
+}
+
+static bool parseStage(const std::string &line, PipelineStage &stage, std::string &error) {
+    std::istringstream tokens(line);
+    tokens >> stage.name;
+    stage.params.clear();
+
+    const StageSpec *spec = findSpec(stage.name);
+    if (!spec) {
+        error = "unknown stage '" + stage.name + "'";
+        return false;
+    }
+
+    std::string token;
+    while (tokens >> token) {
+        size_t eq = token.find('=');
+        if (eq == std::string::npos || eq == 0) {
+            error = "expected key=value, got '" + token + "'";
+            return false;
+        }
+        std::string key = token.substr(0, eq);
+        std::string value = token.substr(eq + 1);
+
+        bool known = false;
+        for (int i = 0; i < 8 && spec->keys[i]; i++) {
+            known = known || key == spec->keys[i];
+        }
+        if (!known) {
+            error = "stage '" + stage.name + "' has no setting '" + key + "'";
+            return false;
+        }
+        if (key == "mode") {
+            if (value != "scanOrder" && value != "spanningTree") {
+                error = "mode must be scanOrder or spanningTree, got '" + value + "'";
+                return false;
+            }
+        } else if (!isNumber(value)) {
+            error = "setting '" + key + "' needs a number, got '" + value + "'";
+            return false;
+        }
+        stage.params.push_back(std::make_pair(key, value));
+    }
+    return true;
+}
+
+static const std::string *findParam(const PipelineStage &stage, const char *key) {
+    // The last occurrence wins
+    for (size_t i = stage.params.size(); i-- > 0;) {
+        if (stage.params[i].first == key) return &stage.params[i].second;
+    }
+    return nullptr;
+}
+
+static float paramFloat(const PipelineStage &stage, const char *key, float fallback) {
+    const std::string *value = findParam(stage, key);
+    return value ? (float)std::atof(value->c_str()) : fallback;
+}
+
+static int paramInt(const PipelineStage &stage, const char *key, int fallback) {
+    const std::string *value = findParam(stage, key);
+    return value ? std::atoi(value->c_str()) : fallback;
+}
+
+GenerationPipeline::GenerationPipeline()
+    : width(256), height(1024), seed(42), countChanges(false) {
+}
+
+bool GenerationPipeline::parse(std::istream &in) {
+    int newWidth = width;
+    int newHeight = height;
+    unsigned int newSeed = seed;
+    std::vector<PipelineStage> newStages;
+
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(in, line)) {
+        lineNumber++;
+        size_t hash = line.find('#');
+        if (hash != std::string::npos) line.erase(hash);
+
+        std::istringstream tokens(line);
+        std::string word;
+        if (!(tokens >> word)) continue;
+
+        std::string error;
+        if (word == "size") {
+            if (!(tokens >> newWidth >> newHeight) || newWidth < 3 || newHeight < 3) {
+                error = "size needs a width and height of at least 3";
+            }
+        } else if (word == "seed") {
+            long long value;
+            if (!(tokens >> value) || value < 0) {
+                error = "seed needs a non-negative integer";
+            } else {
+                newSeed = (unsigned int)value;
+            }
+        } else {
+            PipelineStage stage;
+            if (parseStage(line, stage, error)) {
+                newStages.push_back(stage);
+            }
+        }
+
+        if (!error.empty()) {
+            std::cerr << "Pipeline config line " << lineNumber << ": " << error << std::endl;
+            return false;
+        }
+    }
+
+    width = newWidth;
+    height = newHeight;
+    seed = newSeed;
+    stages.swap(newStages);
+    stats.clear();
+    return true;
+}
+
+bool GenerationPipeline::parse(const std::string &text) {
+    std::istringstream in(text);
+    return parse(in);
+}
+
+bool GenerationPipeline::loadFile(const std::string &path) {
+    std::ifstream in(path.c_str());
+    if (!in) {
+        std::cerr << "Cannot open pipeline config: " << path << std::endl;
+        return false;
+    }
+    return parse(in);
+}
+
+bool GenerationPipeline::addStage(const std::string &line) {
+    PipelineStage stage;
+    std::string error;
+    if (!parseStage(line, stage, error)) {
+        std::cerr << "Pipeline stage: " << error << std::endl;
+        return false;
+    }
+    stages.push_back(stage);
+    return true;
+}
+
+std::string GenerationPipeline::describe() const {
+    std::ostringstream out;
+    out << "size " << width << " " << height << "\n";
+    out << "seed " << seed << "\n";
+    for (size_t i = 0; i < stages.size(); i++) {
+        out << stages[i].name;
+        for (size_t p = 0; p < stages[i].params.size(); p++) {
+            out << " " << stages[i].params[p].first << "=" << stages[i].params[p].second;
+        }
+        out << "\n";
+    }
+    return out.str();
+}
+
+void GenerationPipeline::runStage(CaveGenerator &generator, const PipelineStage &stage) const {
+    const std::string &name = stage.name;
+    if (name == "cellularAutomata") {
+        generator.generateCellularAutomata(paramFloat(stage, "fill", 0.47f),
+                                           paramInt(stage, "iterations", 5));
+    } else if (name == "perlinNoise") {
+        NoiseParams params;
+        params.scale = paramFloat(stage, "scale", params.scale);
+        params.octaves = paramInt(stage, "octaves", params.octaves);
+        params.lacunarity = paramFloat(stage, "lacunarity", params.lacunarity);
+        params.gain = paramFloat(stage, "gain", params.gain);
+        params.warpStrength = paramFloat(stage, "warp", params.warpStrength);
+        params.warpScale = paramFloat(stage, "warpScale", params.warpScale);
+        generator.generatePerlinNoise(params, paramFloat(stage, "threshold", 0.4f));
+    } else if (name == "randomWalk") {
+        generator.generateRandomWalk(paramInt(stage, "walks", 50), paramInt(stage, "length", 500));
+    } else if (name == "smooth") {
+        int radius = paramInt(stage, "radius", 1);
+        if (radius > 1) {
+            generator.smoothMapBox(radius, paramInt(stage, "iterations", 1));
+        } else {
+            generator.smoothMap(paramInt(stage, "iterations", 1));
+        }
+    } else if (name == "fillSmallCaverns") {
+        generator.fillSmallCaverns(paramInt(stage, "minSize", 5));
+    } else if (name == "connectCaverns") {
+        const std::string *mode = findParam(stage, "mode");
+        CavernConnection connection = (mode && *mode == "spanningTree")
+            ? CONNECT_SPANNING_TREE : CONNECT_SCAN_ORDER;
+        generator.connectAllCaverns(connection, paramInt(stage, "width", 20));
+    } else if (name == "entrance") {
+        generator.ensureTopCenterEntrance();
+    } else if (name == "contours") {
+        generator.extractContours(paramFloat(stage, "tolerance", 0.5f));
+    }
+}
+
+void GenerationPipeline::run(CaveGenerator &generator) {
+    stats.clear();
+    for (size_t i = 0; i < stages.size() && !generator.isCancelled(); i++) {
+        TileGrid before;
+        if (countChanges) {
+            before = generator.getMap();
+        }
+        size_t bytesBefore = alloc_stats_total_bytes();
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+        runStage(generator, stages[i]);
+
+        StageStats s;
+        s.name = stages[i].name;
+        s.ms = std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - start).count();
+        s.allocatedBytes = alloc_stats_total_bytes() - bytesBefore;
+
+        const TileGrid &after = generator.getMap();
+        if (!countChanges) {
+            s.cellsChanged = 0;
+        } else if (before.getWidth() == after.getWidth() && before.getHeight() == after.getHeight()) {
+            s.cellsChanged = 0;
+            const uint8_t *a = before.data();
+            const uint8_t *b = after.data();
+            for (size_t c = 0; c < after.size(); c++) {
+                s.cellsChanged += a[c] != b[c];
+            }
+        } else {
+            s.cellsChanged = after.size();
+        }
+        stats.push_back(s);
+    }
+}
+
+static void writeJsonString(std::ostream &out, const std::string &text) {
+    out << '"';
+    for (size_t i = 0; i < text.size(); i++) {
+        char c = text[i];
+        if (c == '"' || c == '\\') {
+            out << '\\' << c;
+        } else if ((unsigned char)c < 0x20) {
+            out << ' ';
+        } else {
+            out << c;
+        }
+    }
+    out << '"';
+}
+
+void GenerationPipeline::writeStatsJson(std::ostream &out) const {
+    double totalMs = 0.0;
+    for (size_t i = 0; i < stats.size(); i++) {
+        totalMs += stats[i].ms;
+    }
+
+    out << "{\n";
+    out << "  \"width\": " << width << ",\n";
+    out << "  \"height\": " << height << ",\n";
+    out << "  \"seed\": " << seed << ",\n";
+    out << "  \"totalMs\": " << totalMs << ",\n";
+    out << "  \"stages\": [";
+    for (size_t i = 0; i < stats.size(); i++) {
+        std::string config = stages[i].name;
+        for (size_t p = 0; p < stages[i].params.size(); p++) {
+            config += " " + stages[i].params[p].first + "=" + stages[i].params[p].second;
+        }
+        out << (i ? ",\n" : "\n") << "    { \"name\": ";
+        writeJsonString(out, stats[i].name);
+        out << ", \"config\": ";
+        writeJsonString(out, config);
+        out << ", \"ms\": " << stats[i].ms
+            << ", \"allocatedBytes\": " << stats[i].allocatedBytes;
+        if (countChanges) {
+            out << ", \"cellsChanged\": " << stats[i].cellsChanged;
+        }
+        out << " }";
+    }
+    out << (stats.empty() ? "]\n" : "\n  ]\n");
+    out << "}\n";
+}
@@ -0,0 +1,95 @@
+#ifndef GENERATION_PIPELINE_H
+#define GENERATION_PIPELINE_H
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <istream>
+#include <ostream>
+#include <cstddef>
+
+class CaveGenerator;
+
+// One configured stage: a CaveGenerator method and its key=value settings
+struct PipelineStage {
+    std::string name;
+    std::vector<std::pair<std::string, std::string>> params;
+};
+
+// What one stage cost on the last run
+struct StageStats {
+    std::string name;
+    double ms;              // wall-clock time
+    size_t allocatedBytes;  // bytes requested from operator new, all threads
+                            // (0 unless alloc_stats.cpp is linked)
+    size_t cellsChanged;    // map cells that differ from before the stage
+                            // (0 unless setCountChanges is on)
+};
+
+// An ordered list of generation stages, described by a small text config:
+//
+//   # comment
+//   size 256 1024
+//   seed 42
+//   randomWalk walks=300 length=3000
+//   smooth iterations=3
+//   fillSmallCaverns minSize=50
+//   connectCaverns mode=spanningTree width=20
+//   entrance
+//
+// Stages: cellularAutomata (fill, iterations), perlinNoise (scale,
+// threshold, octaves, lacunarity, gain, warp, warpScale), randomWalk
+// (walks, length), smooth (iterations, radius), fillSmallCaverns (minSize),
+// connectCaverns (mode=scanOrder|spanningTree, width), entrance,
+// contours (tolerance).
+// Omitted settings take the CaveGenerator defaults.
+class GenerationPipeline {
+private:
+    int width;
+    int height;
+    unsigned int seed;
+    std::vector<PipelineStage> stages;
+    std::vector<StageStats> stats;
+    bool countChanges;
+
+    void runStage(CaveGenerator &generator, const PipelineStage &stage) const;
+
+public:
+    GenerationPipeline();
+
+    // Parse a config, replacing the current one. Errors go to std::cerr with
+    // the line number; on failure the pipeline is left unchanged.
+    bool parse(std::istream &in);
+    bool parse(const std::string &text);
+    bool loadFile(const std::string &path);
+
+    // Append one stage given as a config line, e.g. "smooth iterations=3"
+    bool addStage(const std::string &line);
+
+    // The config text for this pipeline (parse() accepts it back)
+    std::string describe() const;
+
+    // Run every stage in order on the generator, recording StageStats.
+    // Stops early if the generator is cancelled.
+    void run(CaveGenerator &generator);
+
+    int getWidth() const { return width; }
+    int getHeight() const { return height; }
+    unsigned int getSeed() const { return seed; }
+    void setSize(int w, int h) { width = w; height = h; }
+    void setSeed(unsigned int s) { seed = s; }
+    // Count each stage's changed cells. Off by default: it keeps a copy of
+    // the map across every stage and compares the whole of it afterwards.
+    void setCountChanges(bool count) { countChanges = count; }
+    int getStageCount() const { return (int)stages.size(); }
+    const std::vector<PipelineStage>& getStages() const { return stages; }
+    const std::vector<StageStats>& getStats() const { return stats; }
+
+    // Stats of the last run as a JSON object
+    void writeStatsJson(std::ostream &out) const;
+
+    // The recipe the game uses when no config is given
+    static const char *DEFAULT_CONFIG;
+};
+
+#endif // GENERATION_PIPELINE_H
@@ -0,0 +1,55 @@
+#ifndef GRID_H
+#define GRID_H
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <algorithm>
+
+// Contiguous row-major 2D grid. Shared by CaveGenerator and Tilemap so a
+// generated map can be moved between them without copying.
+template <typename T>
+class Grid {
+private:
+    int width;
+    int height;
+    std::vector<T> cells;
+
+public:
+    Grid() : width(0), height(0) {}
+    Grid(int w, int h, T fill = T())
+        : width(w), height(h), cells((size_t)w * h, fill) {}
+
+    void resize(int w, int h, T fill = T()) {
+        width = w;
+        height = h;
+        cells.assign((size_t)w * h, fill);
+    }
+
+    void fill(T value) { std::fill(cells.begin(), cells.end(), value); }
+
+    int getWidth() const { return width; }
+    int getHeight() const { return height; }
+    size_t size() const { return cells.size(); }
+    bool empty() const { return cells.empty(); }
+
+    bool inBounds(int x, int y) const {
+        return x >= 0 && x < width && y >= 0 && y < height;
+    }
+
+    // Unchecked access
+    T& at(int x, int y) { return cells[(size_t)y * width + x]; }
+    const T& at(int x, int y) const { return cells[(size_t)y * width + x]; }
+
+    T* row(int y) { return &cells[(size_t)y * width]; }
+    const T* row(int y) const { return &cells[(size_t)y * width]; }
+
+    T* data() { return cells.data(); }
+    const T* data() const { return cells.data(); }
+};
+
+// One byte per cell: values are small indices (e.g. wall/floor flags or
+// palette entries), not spritesheet tile ids.
+typedef Grid<uint8_t> TileGrid;
+
+#endif // GRID_H
@@ -4,17 +4,46 @@
 #include "physics.h"
 #include "graphics.h"
 #include "tilemap.h"
+#include "autotile.h"
 #include "cave_generator.h"
+#include "generation_job.h"
+#include "generation_pipeline.h"
 #include "joystick_manager.h"
 #include <SDL2/SDL.h>
 #include <cmath>
+#include <string>
 
-#define WIDTH 256
-#define HEIGHT 1024
+#define WIDTH 256   // map width in --infinite mode (4 chunks of 64)
 
 int main(int argc, char *argv[]) {
-    (void)argc;
-    (void)argv;
+    // --infinite streams an endless cave in chunks instead of generating it up front;
+    // --pipeline FILE replaces the built-in generation recipe;
+    // --render tiles|blocks|geometry picks how the tilemap is drawn;
+    // --map FILE streams a saved map (see cavegen --map) instead of generating
+    bool infinite = false;
+    std::string renderMode;
+    std::string mapFile;
+    GenerationPipeline pipeline;
+    pipeline.parse(GenerationPipeline::DEFAULT_CONFIG);
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--infinite") {
+            infinite = true;
+        } else if (arg == "--pipeline" && i + 1 < argc) {
+            if (!pipeline.loadFile(argv[++i])) {
+                return 1;
+            }
+        } else if (arg == "--render" && i + 1 < argc) {
+            renderMode = argv[++i];
+        } else if (arg == "--map" && i + 1 < argc) {
+            mapFile = argv[++i];
+        }
+    }
+    bool generate = !infinite && mapFile.empty();
+    // A map file brings its own size
+    int mapWidth = !mapFile.empty() ? 0 : infinite ? WIDTH : pipeline.getWidth();
+    int mapHeight = !mapFile.empty() ? 0 : pipeline.getHeight();
+    const int RESIDENT_CHUNK_ROWS = 6;
 
     // Initialize the game engine
     if (!engine_init("LeadRose - Procedural Cave Generator", 800, 600)) {
@@ -22,25 +51,103 @@ int main(int argc, char *argv[]) {
         return 1;
     }
 
-    // Create and generate a WIDTH*HEIGHT cave map
-    std::cout << "Generating WIDTH*HEIGHT cave map..." << std::endl;
-    CaveGenerator caveGen(WIDTH, HEIGHT, 42);
+    // Create the cave generator (chunked mode keeps no map of its own)
+    CaveGenerator caveGen(mapWidth, generate ? mapHeight : 0, pipeline.getSeed());
     
-    // Choose generation method with parameters scaled for 8x larger map
-    std::cout << "Using random walk generation (scaled for WIDTH*HEIGHT)..." << std::endl;
-    caveGen.generateRandomWalk(300, 3000);  // 300 walks, 3000 steps each (8x larger)
-    caveGen.smoothMap(3);                     // Smooth 3 times
-    caveGen.fillSmallCaverns(50);             // Fill caverns smaller than 50 tiles
-    caveGen.connectAllCaverns();              // Connect isolated caverns for playable tunnels
-    caveGen.ensureTopCenterEntrance();        // Ensure entrance at top center with passage down
+    if (generate) {
+        // Generate on a worker thread so the window shows progress right away
+        std::cout << "Generating " << mapWidth << "x" << mapHeight << " cave with pipeline:\n"
+                  << pipeline.describe() << std::flush;
+        GenerationJob job(caveGen, [&pipeline](CaveGenerator &gen) {
+            pipeline.run(gen);
+        });
+        
+        // Loading frames: a progress bar until the map is final
+        SDL_Event event;
+        while (!job.isDone()) {
+            while (SDL_PollEvent(&event)) {
+                if (event.type == SDL_QUIT ||
+                    (event.type == SDL_KEYDOWN && event.key.keysym.sym == SDLK_ESCAPE)) {
+                    job.cancel();
+                }
+            }
+            
+            GenerationProgress progress = job.getProgress();
+            int stagesDone = (int)job.getFinishedStages().size();
+            float fraction = (stagesDone + (progress.fraction < 1.0f ? progress.fraction : 0.0f)) / std::max(1, pipeline.getStageCount());
+            fraction = std::min(1.0f, fraction);
+            
+            SDL_SetRenderDrawColor(engine_get_renderer(), 20, 20, 30, 255);
+            SDL_RenderClear(engine_get_renderer());
+            graphics_draw_rect(engine_get_renderer(), 200.0f, 290.0f, 400.0f, 20.0f, 100, 200, 255, 255);
+            graphics_draw_filled_rect(engine_get_renderer(), 202.0f, 292.0f, 396.0f * fraction, 16.0f, 100, 200, 255, 255);
+            SDL_RenderPresent(engine_get_renderer());
+            SDL_Delay(16);
+        }
+        
+        if (job.isCancelled()) {
+            std::cout << "Generation cancelled" << std::endl;
+            engine_cleanup();
+            return 0;
+        }
+        const std::vector<StageStats> &stats = pipeline.getStats();
+        for (size_t i = 0; i < stats.size(); i++) {
+            std::cout << "  " << stats[i].name << ": " << stats[i].ms << " ms" << std::endl;
+        }
+        std::cout << "Generation finished in " << job.getElapsedMs() << " ms" << std::endl;
+    }
 
     // Create large tilemap and load generated map
-    std::cout << "Creating WIDTH*HEIGHT tilemap..." << std::endl;
-    Tilemap tilemap(engine_get_renderer(), "Spritesheet/roguelikeDungeon_transparent.png", 16, 16, WIDTH, HEIGHT);
+    std::cout << "Creating " << mapWidth << "x" << mapHeight << " tilemap..." << std::endl;
+    Tilemap tilemap(engine_get_renderer(), "Spritesheet/roguelikeDungeon_transparent.png", 16, 16, mapWidth, mapHeight);
+    if (renderMode == "tiles") {
+        tilemap.setRenderMode(RENDER_TILES);
+    } else if (renderMode == "blocks") {
+        tilemap.setRenderMode(RENDER_CACHED_BLOCKS);
+    } else if (renderMode == "geometry") {
+        tilemap.setRenderMode(RENDER_GEOMETRY);
+    } else if (!renderMode.empty()) {
+        std::cerr << "Unknown render mode '" << renderMode << "', using the default" << std::endl;
+    }
+    // Without render targets the default is the geometry batch
+    const char *modeNames[] = { "tiles", "blocks", "geometry" };
+    std::cout << "Render mode: " << modeNames[tilemap.getRenderMode()] << std::endl;
     
-    auto flatMap = caveGen.getMapFlat();
-    tilemap.loadMapFromArray(flatMap.data());
-    std::cout << "Tilemap loaded successfully" << std::endl;
+    if (!mapFile.empty()) {
+        // Chunks are decoded from the file as the player approaches them
+        if (!tilemap.openMapFile(mapFile, RESIDENT_CHUNK_ROWS)) {
+            engine_cleanup();
+            return 1;
+        }
+        mapWidth = tilemap.getMapWidth();
+        mapHeight = tilemap.getMapHeight();
+    } else if (infinite) {
+        // Chunks are generated as the player approaches them
+        ChunkSource source = [&caveGen](int chunkX, int chunkY, TileGrid &chunk) {
+            caveGen.generateChunk(chunkX, chunkY, chunk);
+        };
+        if (!tilemap.enableStreaming(source, caveGen.getPalette(),
+                                     caveGen.getChunkSettings().chunkSize, RESIDENT_CHUNK_ROWS)) {
+            engine_cleanup();
+            return 1;
+        }
+        std::cout << "Streaming cave chunks on demand" << std::endl;
+    } else {
+        // Hand the generated grid over without copying it
+        tilemap.loadMap(caveGen.takeMap(), caveGen.getPalette());
+        std::cout << "Tilemap loaded successfully (" << tilemap.getTileMemoryUsage() / 1024
+                  << " KB, " << tilemap.getDenseChunkCount() << " mixed chunks)" << std::endl;
+    }
+    tilemap.setSolidTiles(caveGen.getSolidTiles());
+    // Walls show a stone edge on each side that faces open cave
+    Autotiler wallTiles;
+    wallTiles.setEdgeTiles(CaveGenerator::getWallEdgeTiles());
+    tilemap.setAutotiler(wallTiles, CaveGenerator::TILE_WALL);
+    // Overview in the corner: one pixel per 2^level tiles, M cycles the level
+    tilemap.enableMinimap(3);
+    int minimapLevel = 1;
+    // Screen pixels per world pixel; - and = halve and double it, 0 resets
+    float zoom = 1.0f;
 
     // Create the physics world with gravity pointing downward
     CPhysicsWorld *world = physics_create_world(0.0f, 9.8f);
@@ -51,15 +158,16 @@ int main(int argc, char *argv[]) {
     }
 
     // Create a dynamic box body (player) at top center
-    // Map is WIDTH*HEIGHT tiles, each 16px, so center is at (4096*16, top*16) = (65536, ~80)
+    // Tiles are 16px, so the map's horizontal centre is (mapWidth * 16) / 2; 80px is five tiles down
     PhysicsBody *player = physics_create_box_body(
-        world, (WIDTH * 16.0f)/2, 80.0f, 12.0f, 16.0f,
+        world, (mapWidth * 16.0f)/2, 80.0f, 12.0f, 16.0f,
         1.0f, BODY_DYNAMIC, "player"
     );
 
     // Create static ground body at bottom of map (far enough to not interfere with cave collisions)
+    float groundY = std::max(131072.0f, tilemap.getMapHeight() * 16.0f + 16.0f);
     physics_create_box_body(
-        world, 65536.0f, 131072.0f, 131072.0f, 10.0f,
+        world, 65536.0f, groundY, 131072.0f, 10.0f,
         0.0f, BODY_STATIC, "ground"
     );
 
@@ -82,12 +190,15 @@ int main(int argc, char *argv[]) {
     const float ROTATION_SPEED = 360.0f;  // Degrees per second (for keyboard)
     
     // Camera position (follows player, starting at top center)
-    float cameraX = (WIDTH * 16.0f)/2 - 400.0f;  // Center player horizontally on screen
-    float cameraY = (HEIGHT * 16.0f)/2 - 300.0f;     // Player at top of screen
+    float cameraX = (mapWidth * 16.0f)/2 - 400.0f;  // Center player horizontally on screen
+    float cameraY = (mapHeight * 16.0f)/2 - 300.0f;     // Player at top of screen
+    
+    // Solid tiles under the player, reused every frame
+    std::vector<SDL_Point> wallHits;
 
     std::cout << "Starting game loop..." << std::endl;
     std::cout << "Joystick Controls: Left stick for 360-degree rotation, Right trigger for rocket throttle" << std::endl;
-    std::cout << "Keyboard Controls: A/D or Arrow Keys for rotation, W to throttle, S for reverse, ESC to quit" << std::endl;
+    std::cout << "Keyboard Controls: A/D or Arrow Keys for rotation, W to throttle, S for reverse, M to zoom the minimap, -/=/0 to zoom, ESC to quit" << std::endl;
     std::cout << "Physics: Gravity pulls player downward, thrust in facing direction propels spaceship" << std::endl;
 
     while (running) {
@@ -100,7 +211,22 @@ int main(int argc, char *argv[]) {
             } else if (event.type == SDL_KEYDOWN) {
                 if (event.key.keysym.sym == SDLK_ESCAPE) {
                     running = false;
+                } else if (event.key.keysym.sym == SDLK_m) {
+                    // No levels to cycle if the minimap could not be built
+                    int levels = tilemap.getMinimapLevelCount();
+                    if (levels > 0) {
+                        minimapLevel = (minimapLevel + 1) % levels;
+                    }
+                } else if (event.key.keysym.sym == SDLK_MINUS) {
+                    zoom = std::max(zoom * 0.5f, 1.0f / 64.0f);
+                } else if (event.key.keysym.sym == SDLK_EQUALS || event.key.keysym.sym == SDLK_PLUS) {
+                    zoom = std::min(zoom * 2.0f, 4.0f);
+                } else if (event.key.keysym.sym == SDLK_0) {
+                    zoom = 1.0f;
                 }
+            } else if (event.type == SDL_RENDER_TARGETS_RESET) {
+                // The driver dropped render target contents; rebake the tiles
+                tilemap.invalidateRenderCache();
             }
         }
 
@@ -159,15 +285,39 @@ int main(int argc, char *argv[]) {
         // Get player position
         b2Vec2 playerPos = player->GetPosition();
         
+        // World pixels the screen spans at this zoom
+        float viewWidth = 800.0f / zoom;
+        float viewHeight = 600.0f / zoom;
+        
+        // Make sure the chunks around the player are generated
+        tilemap.streamAround(playerPos.x - viewWidth / 2, playerPos.y - viewHeight / 2,
+                             (int)viewWidth, (int)viewHeight);
+        // Animated tiles move on; only their cells are redrawn
+        tilemap.updateAnimations(SDL_GetTicks());
+        
         // Collision detection with cave walls
-        // Check tiles around player bounding box
+        // Find every solid tile the player's bounding box overlaps
         float playerRadius = 8.0f;  // Half of player width/height
+        wallHits.clear();
+        tilemap.querySolid(playerPos.x - playerRadius, playerPos.y - playerRadius,
+                           2 * playerRadius, 2 * playerRadius, wallHits);
         
-        // Check if player overlaps with solid tiles
-        bool collidingLeft = tilemap.isSolidTile((int)((playerPos.x - playerRadius) / 16), (int)(playerPos.y / 16));
-        bool collidingRight = tilemap.isSolidTile((int)((playerPos.x + playerRadius) / 16), (int)(playerPos.y / 16));
-        bool collidingTop = tilemap.isSolidTile((int)(playerPos.x / 16), (int)((playerPos.y - playerRadius) / 16));
-        bool collidingBottom = tilemap.isSolidTile((int)(playerPos.x / 16), (int)((playerPos.y + playerRadius) / 16));
+        // Each solid tile blocks motion towards the side it is on
+        bool collidingLeft = false;
+        bool collidingRight = false;
+        bool collidingTop = false;
+        bool collidingBottom = false;
+        for (size_t i = 0; i < wallHits.size(); i++) {
+            float dx = (wallHits[i].x + 0.5f) * 16 - playerPos.x;
+            float dy = (wallHits[i].y + 0.5f) * 16 - playerPos.y;
+            if (std::fabs(dx) > std::fabs(dy)) {
+                if (dx < 0) collidingLeft = true;
+                else collidingRight = true;
+            } else {
+                if (dy < 0) collidingTop = true;
+                else collidingBottom = true;
+            }
+        }
         
         // Get current velocity
         b2Vec2 velocity = player->GetLinearVelocity();
@@ -190,14 +340,14 @@ int main(int argc, char *argv[]) {
         player->SetLinearVelocity(velocity);
 
         // Keep player centered on screen
-        float targetCameraX = playerPos.x - 400.0f;  // 400 = 800/2, center horizontally
-        float targetCameraY = playerPos.y - 300.0f;  // 300 = 600/2, center vertically
+        float targetCameraX = playerPos.x - viewWidth / 2;
+        float targetCameraY = playerPos.y - viewHeight / 2;
         
-        // Clamp camera to map boundaries (WIDTH*HEIGHT tiles, 16px per tile)
-        float mapPixelWidth = WIDTH * 16.0f; 
-        float mapPixelHeight = HEIGHT * 16.0f;
-        targetCameraX = std::max(0.0f, std::min(targetCameraX, mapPixelWidth - 800.0f));
-        targetCameraY = std::max(0.0f, std::min(targetCameraY, mapPixelHeight - 600.0f));
+        // Clamp camera to map boundaries (16px per tile)
+        float mapPixelWidth = tilemap.getMapWidth() * 16.0f; 
+        float mapPixelHeight = tilemap.getMapHeight() * 16.0f;
+        targetCameraX = std::max(0.0f, std::min(targetCameraX, mapPixelWidth - viewWidth));
+        targetCameraY = std::max(0.0f, std::min(targetCameraY, mapPixelHeight - viewHeight));
         
         // Immediately center camera on player (no smoothing for instant centering)
         cameraX = targetCameraX;
@@ -208,13 +358,13 @@ int main(int argc, char *argv[]) {
         SDL_RenderClear(engine_get_renderer());
 
         // Render tilemap with camera viewport
-        tilemap.renderViewport(cameraX, cameraY, 800, 600);
+        tilemap.renderViewport(cameraX, cameraY, 800, 600, zoom);
 
         // Render player as a rotated triangle (spaceship-like)
         float halfWidth = 6.0f;
         float halfHeight = 8.0f;
-        float screenX = playerPos.x - cameraX;
-        float screenY = playerPos.y - cameraY;
+        float screenX = (playerPos.x - cameraX) * zoom;
+        float screenY = (playerPos.y - cameraY) * zoom;
         
         // Draw a triangle pointing in the direction of rotation
         float rad = playerRotation * (3.14159265359f / 180.0f);
@@ -248,6 +398,30 @@ int main(int argc, char *argv[]) {
                 flame_x, flame_y,
                 255, flame_color, 0, 255);
         }
+        
+        // Foreground tile layers go over the ship
+        tilemap.renderOverlays(cameraX, cameraY, 800, 600, zoom);
+
+        // Minimap centred on the ship, drawn with one copy (none if the map
+        // is too big for a texture)
+        int minimapLevels = tilemap.getMinimapLevelCount();
+        if (minimapLevels > 0) {
+            minimapLevel = std::min(minimapLevel, minimapLevels - 1);
+            SDL_Rect minimapRect = { 800 - 170, 10, 160, 200 };
+            SDL_Rect minimapArea = {
+                (int)(playerPos.x / 16) - (minimapRect.w << minimapLevel) / 2,
+                (int)(playerPos.y / 16) - (minimapRect.h << minimapLevel) / 2,
+                minimapRect.w << minimapLevel, minimapRect.h << minimapLevel
+            };
+            graphics_draw_filled_rect(engine_get_renderer(), minimapRect.x, minimapRect.y,
+                                      minimapRect.w, minimapRect.h, 0, 0, 0, 160);
+            tilemap.renderMinimap(minimapLevel, &minimapArea, minimapRect);
+            graphics_draw_rect(engine_get_renderer(), minimapRect.x, minimapRect.y,
+                               minimapRect.w, minimapRect.h, 100, 200, 255, 255);
+            graphics_draw_filled_rect(engine_get_renderer(),
+                                      minimapRect.x + minimapRect.w / 2 - 1, minimapRect.y + minimapRect.h / 2 - 1,
+                                      3, 3, 255, 255, 255, 255);
+        }
 
         SDL_RenderPresent(engine_get_renderer());
 
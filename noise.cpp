@@ -0,0 +1,207 @@
+#include "noise.h"
+#include "cpu_features.h"
+#include <cmath>
+#include <random>
+#include <algorithm>
+
+#ifdef HAVE_AVX2_KERNELS
+#include <immintrin.h>
+#endif
+
+// Eight unit-ish gradient directions, indexed by hash & 7
+static const float GRAD_X[8] = { 1.0f, -1.0f,  1.0f, -1.0f, 1.0f, -1.0f, 0.0f,  0.0f };
+static const float GRAD_Y[8] = { 1.0f,  1.0f, -1.0f, -1.0f, 0.0f,  0.0f, 1.0f, -1.0f };
+
+// Offsets that decorrelate the two domain-warp lookups from the main field
+static const float WARP_X_OFFSET_X = 31.7f;
+static const float WARP_X_OFFSET_Y = 11.3f;
+static const float WARP_Y_OFFSET_X = 5.9f;
+static const float WARP_Y_OFFSET_Y = 47.1f;
+
+GradientNoise::GradientNoise(unsigned int seed) {
+    for (int i = 0; i < 256; i++) {
+        perm[i] = i;
+    }
+    std::mt19937 rng(seed);
+    for (int i = 255; i > 0; i--) {
+        std::uniform_int_distribution<int> pick(0, i);
+        std::swap(perm[i], perm[pick(rng)]);
+    }
+    for (int i = 0; i < 256; i++) {
+        perm[256 + i] = perm[i];
+    }
+}
+
+static inline float fade(float t) {
+    return t * t * t * (t * (t * 6.0f - 15.0f) + 10.0f);
+}
+
+static inline float grad(int hash, float x, float y) {
+    return GRAD_X[hash & 7] * x + GRAD_Y[hash & 7] * y;
+}
+
+float GradientNoise::noise(float x, float y) const {
+    float fx = std::floor(x);
+    float fy = std::floor(y);
+    int xi = (int)fx;
+    int yi = (int)fy;
+    float xf = x - fx;
+    float yf = y - fy;
+
+    int px0 = perm[xi & 255];
+    int px1 = perm[(xi + 1) & 255];
+    int y0 = yi & 255;
+    int y1 = (yi + 1) & 255;
+
+    float n00 = grad(perm[px0 + y0], xf, yf);
+    float n10 = grad(perm[px1 + y0], xf - 1.0f, yf);
+    float n01 = grad(perm[px0 + y1], xf, yf - 1.0f);
+    float n11 = grad(perm[px1 + y1], xf - 1.0f, yf - 1.0f);
+
+    float u = fade(xf);
+    float v = fade(yf);
+    float nx0 = n00 + u * (n10 - n00);
+    float nx1 = n01 + u * (n11 - n01);
+    return nx0 + v * (nx1 - nx0);
+}
+
+float GradientNoise::fbm(int x, int y, const NoiseParams &params) const {
+    float px = (float)x * params.scale;
+    float py = (float)y * params.scale;
+
+    if (params.warpStrength != 0.0f) {
+        float wx = px * params.warpScale;
+        float wy = py * params.warpScale;
+        float ox = noise(wx + WARP_X_OFFSET_X, wy + WARP_X_OFFSET_Y);
+        float oy = noise(wx + WARP_Y_OFFSET_X, wy + WARP_Y_OFFSET_Y);
+        px = px + params.warpStrength * ox;
+        py = py + params.warpStrength * oy;
+    }
+
+    int octaves = std::max(1, params.octaves);
+    float sum = 0.0f;
+    float norm = 0.0f;
+    float amp = 1.0f;
+    float freq = 1.0f;
+    for (int o = 0; o < octaves; o++) {
+        sum = sum + amp * noise(px * freq, py * freq);
+        norm = norm + amp;
+        amp = amp * params.gain;
+        freq = freq * params.lacunarity;
+    }
+    return (sum / norm) * 0.5f + 0.5f;
+}
+
+#ifdef HAVE_AVX2_KERNELS
+__attribute__((target("avx2")))
+static inline __m256 fade8(__m256 t) {
+    __m256 t3 = _mm256_mul_ps(_mm256_mul_ps(t, t), t);
+    __m256 inner = _mm256_sub_ps(_mm256_mul_ps(t, _mm256_set1_ps(6.0f)), _mm256_set1_ps(15.0f));
+    inner = _mm256_add_ps(_mm256_mul_ps(t, inner), _mm256_set1_ps(10.0f));
+    return _mm256_mul_ps(t3, inner);
+}
+
+__attribute__((target("avx2")))
+static inline __m256 grad8(__m256i hash, __m256 x, __m256 y) {
+    __m256i index = _mm256_and_si256(hash, _mm256_set1_epi32(7));
+    __m256 gx = _mm256_i32gather_ps(GRAD_X, index, 4);
+    __m256 gy = _mm256_i32gather_ps(GRAD_Y, index, 4);
+    return _mm256_add_ps(_mm256_mul_ps(gx, x), _mm256_mul_ps(gy, y));
+}
+
+// Eight lanes of GradientNoise::noise
+__attribute__((target("avx2")))
+static inline __m256 noise8(const int32_t *perm, __m256 x, __m256 y) {
+    const __m256i mask = _mm256_set1_epi32(255);
+    const __m256i one = _mm256_set1_epi32(1);
+    const __m256 onef = _mm256_set1_ps(1.0f);
+
+    __m256 fx = _mm256_floor_ps(x);
+    __m256 fy = _mm256_floor_ps(y);
+    __m256i xi = _mm256_cvttps_epi32(fx);
+    __m256i yi = _mm256_cvttps_epi32(fy);
+    __m256 xf = _mm256_sub_ps(x, fx);
+    __m256 yf = _mm256_sub_ps(y, fy);
+
+    __m256i px0 = _mm256_i32gather_epi32(perm, _mm256_and_si256(xi, mask), 4);
+    __m256i px1 = _mm256_i32gather_epi32(perm, _mm256_and_si256(_mm256_add_epi32(xi, one), mask), 4);
+    __m256i y0 = _mm256_and_si256(yi, mask);
+    __m256i y1 = _mm256_and_si256(_mm256_add_epi32(yi, one), mask);
+
+    __m256i h00 = _mm256_i32gather_epi32(perm, _mm256_add_epi32(px0, y0), 4);
+    __m256i h10 = _mm256_i32gather_epi32(perm, _mm256_add_epi32(px1, y0), 4);
+    __m256i h01 = _mm256_i32gather_epi32(perm, _mm256_add_epi32(px0, y1), 4);
+    __m256i h11 = _mm256_i32gather_epi32(perm, _mm256_add_epi32(px1, y1), 4);
+
+    __m256 xf1 = _mm256_sub_ps(xf, onef);
+    __m256 yf1 = _mm256_sub_ps(yf, onef);
+    __m256 n00 = grad8(h00, xf, yf);
+    __m256 n10 = grad8(h10, xf1, yf);
+    __m256 n01 = grad8(h01, xf, yf1);
+    __m256 n11 = grad8(h11, xf1, yf1);
+
+    __m256 u = fade8(xf);
+    __m256 v = fade8(yf);
+    __m256 nx0 = _mm256_add_ps(n00, _mm256_mul_ps(u, _mm256_sub_ps(n10, n00)));
+    __m256 nx1 = _mm256_add_ps(n01, _mm256_mul_ps(u, _mm256_sub_ps(n11, n01)));
+    return _mm256_add_ps(nx0, _mm256_mul_ps(v, _mm256_sub_ps(nx1, nx0)));
+}
+
+// fBm for 8 consecutive cells starting at x0; mirrors GradientNoise::fbm
+__attribute__((target("avx2")))
+static void fbmRowAvx2(const int32_t *perm, int y, int x0, int count,
+                       const NoiseParams &params, float *out) {
+    const __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    const __m256 scale = _mm256_set1_ps(params.scale);
+    const __m256 py0 = _mm256_set1_ps((float)y * params.scale);
+    int octaves = std::max(1, params.octaves);
+
+    for (int i = 0; i + 8 <= count; i += 8) {
+        __m256i xs = _mm256_add_epi32(_mm256_set1_epi32(x0 + i), lane);
+        __m256 px = _mm256_mul_ps(_mm256_cvtepi32_ps(xs), scale);
+        __m256 py = py0;
+
+        if (params.warpStrength != 0.0f) {
+            __m256 warpScale = _mm256_set1_ps(params.warpScale);
+            __m256 strength = _mm256_set1_ps(params.warpStrength);
+            __m256 wx = _mm256_mul_ps(px, warpScale);
+            __m256 wy = _mm256_mul_ps(py, warpScale);
+            __m256 ox = noise8(perm, _mm256_add_ps(wx, _mm256_set1_ps(WARP_X_OFFSET_X)),
+                               _mm256_add_ps(wy, _mm256_set1_ps(WARP_X_OFFSET_Y)));
+            __m256 oy = noise8(perm, _mm256_add_ps(wx, _mm256_set1_ps(WARP_Y_OFFSET_X)),
+                               _mm256_add_ps(wy, _mm256_set1_ps(WARP_Y_OFFSET_Y)));
+            px = _mm256_add_ps(px, _mm256_mul_ps(strength, ox));
+            py = _mm256_add_ps(py, _mm256_mul_ps(strength, oy));
+        }
+
+        __m256 sum = _mm256_setzero_ps();
+        float norm = 0.0f;
+        float amp = 1.0f;
+        float freq = 1.0f;
+        for (int o = 0; o < octaves; o++) {
+            __m256 f = _mm256_set1_ps(freq);
+            __m256 n = noise8(perm, _mm256_mul_ps(px, f), _mm256_mul_ps(py, f));
+            sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_set1_ps(amp), n));
+            norm = norm + amp;
+            amp = amp * params.gain;
+            freq = freq * params.lacunarity;
+        }
+        __m256 result = _mm256_div_ps(sum, _mm256_set1_ps(norm));
+        result = _mm256_add_ps(_mm256_mul_ps(result, _mm256_set1_ps(0.5f)), _mm256_set1_ps(0.5f));
+        _mm256_storeu_ps(out + i, result);
+    }
+}
+#endif
+
+void GradientNoise::fbmRow(int y, int x0, int count, const NoiseParams &params, float *out) const {
+    int i = 0;
+#ifdef HAVE_AVX2_KERNELS
+    if (cpu_has_avx2()) {
+        fbmRowAvx2(perm, y, x0, count, params, out);
+        i = count & ~7;
+    }
+#endif
+    for (; i < count; i++) {
+        out[i] = fbm(x0 + i, y, params);
+    }
+}
@@ -0,0 +1,41 @@
+#ifndef NOISE_H
+#define NOISE_H
+
+#include <cstdint>
+
+// Fractal (fBm) settings for GradientNoise
+struct NoiseParams {
+    float scale;         // world units per cell at the base octave
+    int octaves;         // number of summed octaves
+    float lacunarity;    // frequency multiplier per octave
+    float gain;          // amplitude multiplier per octave
+    float warpStrength;  // domain warp offset in noise units (0 = off)
+    float warpScale;     // frequency of the warp field relative to scale
+
+    NoiseParams()
+        : scale(0.05f), octaves(4), lacunarity(2.0f), gain(0.5f),
+          warpStrength(0.0f), warpScale(0.5f) {}
+};
+
+// 2D Perlin gradient noise with a seeded permutation table. Rows can be
+// evaluated 8 cells at a time with an AVX2 kernel, picked at runtime; the
+// scalar and vector paths perform the same float operations in the same
+// order, so results do not depend on the CPU.
+class GradientNoise {
+private:
+    int32_t perm[512];
+
+public:
+    explicit GradientNoise(unsigned int seed);
+
+    // Single-octave noise, roughly in [-1, 1]
+    float noise(float x, float y) const;
+
+    // fBm for cell (x, y), mapped to [0, 1]
+    float fbm(int x, int y, const NoiseParams &params) const;
+
+    // fBm for cells x0 .. x0 + count - 1 of row y
+    void fbmRow(int y, int x0, int count, const NoiseParams &params, float *out) const;
+};
+
+#endif // NOISE_H
@@ -0,0 +1,165 @@
+#include "sparse_grid.h"
+#include <algorithm>
+#include <cstring>
+
+const int SparseTileGrid::CHUNK_SHIFT;
+const int SparseTileGrid::CHUNK_SIZE;
+const int SparseTileGrid::CHUNK_MASK;
+
+// One chunk row of every value, so span() can hand out a row of a uniform
+// chunk without a dense array behind it
+struct UniformRows {
+    uint8_t rows[256][SparseTileGrid::CHUNK_SIZE];
+    UniformRows() {
+        for (int v = 0; v < 256; v++) {
+            std::memset(rows[v], v, sizeof(rows[v]));
+        }
+    }
+};
+static const UniformRows uniformRows;
+
+SparseTileGrid::SparseTileGrid(const TileGrid &cells) {
+    resize(cells.getWidth(), cells.getHeight(), 0);
+    for (int cy = 0; cy < chunksDown; cy++) {
+        int y0 = cy * CHUNK_SIZE;
+        int y1 = std::min(height, y0 + CHUNK_SIZE);
+        for (int cx = 0; cx < chunksAcross; cx++) {
+            int x0 = cx * CHUNK_SIZE;
+            int count = std::min(width, x0 + CHUNK_SIZE) - x0;
+            size_t chunk = (size_t)cy * chunksAcross + cx;
+            uint8_t first = cells.row(y0)[x0];
+            bool same = true;
+            for (int y = y0; y < y1 && same; y++) {
+                const uint8_t *src = cells.row(y) + x0;
+                for (int x = 0; x < count; x++) {
+                    if (src[x] != first) {
+                        same = false;
+                        break;
+                    }
+                }
+            }
+            uniform[chunk] = first;
+            if (same) continue;
+            DenseChunk *dst = writableChunk(chunk);
+            for (int y = y0; y < y1; y++) {
+                std::memcpy(dst->cells + cellIndex(0, y), cells.row(y) + x0, count);
+            }
+        }
+    }
+}
+
+void SparseTileGrid::resize(int w, int h, uint8_t fill) {
+    width = std::max(0, w);
+    height = std::max(0, h);
+    chunksAcross = (width + CHUNK_MASK) >> CHUNK_SHIFT;
+    chunksDown = (height + CHUNK_MASK) >> CHUNK_SHIFT;
+    size_t chunks = (size_t)chunksAcross * chunksDown;
+    uniform.assign(chunks, fill);
+    dense.clear();
+    dense.resize(chunks);
+}
+
+void SparseTileGrid::fill(uint8_t value) {
+    std::fill(uniform.begin(), uniform.end(), value);
+    for (size_t i = 0; i < dense.size(); i++) {
+        dense[i].reset();
+    }
+}
+
+SparseTileGrid::DenseChunk* SparseTileGrid::writableChunk(size_t chunk) {
+    std::shared_ptr<DenseChunk> &cells = dense[chunk];
+    if (cells && cells.unique()) {
+        return cells.get();
+    }
+    std::shared_ptr<DenseChunk> copy = std::make_shared<DenseChunk>();
+    if (cells) {
+        std::memcpy(copy->cells, cells->cells, sizeof(copy->cells));
+    } else {
+        std::memset(copy->cells, uniform[chunk], sizeof(copy->cells));
+    }
+    cells = copy;
+    return cells.get();
+}
+
+const uint8_t* SparseTileGrid::span(int x, int y) const {
+    size_t chunk = chunkIndex(x, y);
+    const DenseChunk *cells = dense[chunk].get();
+    if (cells) {
+        return cells->cells + cellIndex(x, y);
+    }
+    return uniformRows.rows[uniform[chunk]] + (x & CHUNK_MASK);
+}
+
+void SparseTileGrid::setRow(int x, int y, const uint8_t *values, int count) {
+    while (count > 0) {
+        int n = std::min(count, spanLength(x));
+        size_t chunk = chunkIndex(x, y);
+        // Writing a uniform chunk's own value leaves it uniform
+        bool unchanged = !dense[chunk];
+        for (int i = 0; i < n && unchanged; i++) {
+            unchanged = values[i] == uniform[chunk];
+        }
+        if (!unchanged) {
+            std::memcpy(writableChunk(chunk)->cells + cellIndex(x, y), values, n);
+        }
+        x += n;
+        values += n;
+        count -= n;
+    }
+}
+
+void SparseTileGrid::compact(int y0, int y1) {
+    y0 = std::max(0, y0);
+    y1 = std::min(height, y1);
+    if (y0 >= y1) return;
+    for (int cy = y0 >> CHUNK_SHIFT; cy <= (y1 - 1) >> CHUNK_SHIFT; cy++) {
+        int rows = std::min(height - cy * CHUNK_SIZE, CHUNK_SIZE);
+        for (int cx = 0; cx < chunksAcross; cx++) {
+            size_t chunk = (size_t)cy * chunksAcross + cx;
+            const DenseChunk *cells = dense[chunk].get();
+            if (!cells) continue;
+            // Only cells inside the map count; the chunk's overhang is unused
+            int columns = std::min(width - cx * CHUNK_SIZE, CHUNK_SIZE);
+            uint8_t first = cells->cells[0];
+            bool same = true;
+            for (int y = 0; y < rows && same; y++) {
+                const uint8_t *row = cells->cells + ((size_t)y << CHUNK_SHIFT);
+                for (int x = 0; x < columns; x++) {
+                    if (row[x] != first) {
+                        same = false;
+                        break;
+                    }
+                }
+            }
+            if (same) {
+                uniform[chunk] = first;
+                dense[chunk].reset();
+            }
+        }
+    }
+}
+
+void SparseTileGrid::copyTo(TileGrid &out) const {
+    out.resize(width, height, 0);
+    for (int y = 0; y < height; y++) {
+        uint8_t *dst = out.row(y);
+        for (int x = 0; x < width; x += spanLength(x)) {
+            int n = std::min(spanLength(x), width - x);
+            std::memcpy(dst + x, span(x, y), n);
+        }
+    }
+}
+
+int SparseTileGrid::getDenseChunkCount() const {
+    int count = 0;
+    for (size_t i = 0; i < dense.size(); i++) {
+        if (dense[i]) count++;
+    }
+    return count;
+}
+
+size_t SparseTileGrid::getMemoryUsage() const {
+    return uniform.capacity() * sizeof(uint8_t) +
+           dense.capacity() * sizeof(std::shared_ptr<DenseChunk>) +
+           (size_t)getDenseChunkCount() * sizeof(DenseChunk);
+}
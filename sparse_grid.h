@@ -0,0 +1,103 @@
+#ifndef SPARSE_GRID_H
+#define SPARSE_GRID_H
+
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+#include "grid.h"
+
+// Byte grid stored as CHUNK_SIZE squares. A chunk holding a single value
+// (solid rock, open air) is just that value; only mixed chunks get a dense
+// array, allocated the first time a write makes them mixed. Dense arrays
+// are shared between copies of the grid and cloned before a write, so a
+// copy is cheap and costs memory only for the chunks that later diverge.
+class SparseTileGrid {
+public:
+    static const int CHUNK_SHIFT = 6;
+    static const int CHUNK_SIZE = 1 << CHUNK_SHIFT;
+    static const int CHUNK_MASK = CHUNK_SIZE - 1;
+
+private:
+    struct DenseChunk {
+        uint8_t cells[CHUNK_SIZE * CHUNK_SIZE];
+    };
+
+    int width;
+    int height;
+    int chunksAcross;
+    int chunksDown;
+    std::vector<uint8_t> uniform;                       // value of each uniform chunk
+    std::vector<std::shared_ptr<DenseChunk> > dense;    // null while uniform
+
+    size_t chunkIndex(int x, int y) const {
+        return (size_t)(y >> CHUNK_SHIFT) * chunksAcross + (x >> CHUNK_SHIFT);
+    }
+    static size_t cellIndex(int x, int y) {
+        return ((size_t)(y & CHUNK_MASK) << CHUNK_SHIFT) | (x & CHUNK_MASK);
+    }
+    // A dense array for the chunk that no other grid shares
+    DenseChunk* writableChunk(size_t chunk);
+
+public:
+    SparseTileGrid() : width(0), height(0), chunksAcross(0), chunksDown(0) {}
+    SparseTileGrid(int w, int h, uint8_t fill = 0) { resize(w, h, fill); }
+    // Compress a dense grid, keeping uniform chunks as single values
+    explicit SparseTileGrid(const TileGrid &cells);
+
+    void resize(int w, int h, uint8_t fill = 0);
+    void fill(uint8_t value);
+
+    int getWidth() const { return width; }
+    int getHeight() const { return height; }
+    bool empty() const { return width == 0 || height == 0; }
+    bool inBounds(int x, int y) const {
+        return x >= 0 && x < width && y >= 0 && y < height;
+    }
+
+    // Unchecked access
+    uint8_t get(int x, int y) const {
+        size_t chunk = chunkIndex(x, y);
+        const DenseChunk *cells = dense[chunk].get();
+        return cells ? cells->cells[cellIndex(x, y)] : uniform[chunk];
+    }
+    void set(int x, int y, uint8_t value) {
+        size_t chunk = chunkIndex(x, y);
+        DenseChunk *cells = dense[chunk].get();
+        if (cells && dense[chunk].unique()) {
+            cells->cells[cellIndex(x, y)] = value;
+        } else if (cells || uniform[chunk] != value) {
+            writableChunk(chunk)->cells[cellIndex(x, y)] = value;
+        }
+    }
+
+    // Row y from column x to the end of x's chunk (spanLength cells), for
+    // loops that walk a row; valid until the next write
+    const uint8_t* span(int x, int y) const;
+    static int spanLength(int x) { return CHUNK_SIZE - (x & CHUNK_MASK); }
+    // Write count cells of row y starting at column x
+    void setRow(int x, int y, const uint8_t *values, int count);
+
+    // Value of the chunk holding (x, y) if it is uniform
+    bool isUniform(int x, int y, uint8_t &value) const {
+        size_t chunk = chunkIndex(x, y);
+        value = uniform[chunk];
+        return !dense[chunk];
+    }
+
+    // Turn dense chunks that have become uniform back into single values,
+    // for the chunk rows overlapping rows [y0, y1)
+    void compact(int y0, int y1);
+    void compact() { compact(0, height); }
+
+    // Expand into a dense grid
+    void copyTo(TileGrid &out) const;
+
+    int getChunkCount() const { return (int)uniform.size(); }
+    int getDenseChunkCount() const;
+    // Bytes held for the chunk table and dense arrays (shared arrays counted
+    // in full by every copy)
+    size_t getMemoryUsage() const;
+};
+
+#endif // SPARSE_GRID_H
@@ -0,0 +1,59 @@
+#include "summed_area_table.h"
+#include "thread_pool.h"
+#include <algorithm>
+
+void SummedAreaTable::build(const TileGrid &map, uint8_t value, ThreadPool *pool) {
+    width = map.getWidth();
+    height = map.getHeight();
+    size_t stride = (size_t)width + 1;
+    sums.assign(stride * (height + 1), 0);
+    uint32_t *data = sums.data();
+
+    // Row prefix sums into rows 1..height
+    auto rowPass = [&map, data, stride, value, this](int y0, int y1) {
+        for (int y = y0; y < y1; y++) {
+            const uint8_t *src = map.row(y);
+            uint32_t *dst = data + (size_t)(y + 1) * stride;
+            uint32_t sum = 0;
+            for (int x = 0; x < width; x++) {
+                sum += src[x] == value;
+                dst[x + 1] = sum;
+            }
+        }
+    };
+
+    // Column prefix sums; each band walks rows top to bottom so reads and
+    // writes stay contiguous
+    auto columnPass = [data, stride, this](int x0, int x1) {
+        for (int y = 2; y <= height; y++) {
+            const uint32_t *above = data + (size_t)(y - 1) * stride;
+            uint32_t *cur = data + (size_t)y * stride;
+            for (int x = x0; x < x1; x++) {
+                cur[x] += above[x];
+            }
+        }
+    };
+
+    if (pool) {
+        pool->parallelFor(0, height, rowPass, 16);
+        pool->parallelFor(1, width + 1, columnPass, 256);
+    } else {
+        rowPass(0, height);
+        columnPass(1, width + 1);
+    }
+}
+
+void SummedAreaTable::clear() {
+    width = 0;
+    height = 0;
+    sums.clear();
+}
+
+int SummedAreaTable::count(int x0, int y0, int x1, int y1) const {
+    x0 = std::max(x0, 0);
+    y0 = std::max(y0, 0);
+    x1 = std::min(x1, width - 1);
+    y1 = std::min(y1, height - 1);
+    if (x0 > x1 || y0 > y1) return 0;
+    return (int)(at(x1 + 1, y1 + 1) - at(x0, y1 + 1) - at(x1 + 1, y0) + at(x0, y0));
+}
@@ -0,0 +1,40 @@
+#ifndef SUMMED_AREA_TABLE_H
+#define SUMMED_AREA_TABLE_H
+
+#include <vector>
+#include <cstdint>
+#include "grid.h"
+
+class ThreadPool;
+
+// Integral image of the cells equal to one value: entry (x, y) holds the
+// count of matching cells in [0, x) x [0, y), so any rectangle count is four
+// lookups. Counts are kept modulo 2^32, which keeps every rectangle count
+// exact even on maps too large for a 32-bit total.
+class SummedAreaTable {
+private:
+    int width;
+    int height;
+    std::vector<uint32_t> sums;  // (width + 1) x (height + 1)
+
+    uint32_t at(int x, int y) const { return sums[(size_t)y * (width + 1) + x]; }
+
+public:
+    SummedAreaTable() : width(0), height(0) {}
+
+    // Rows are summed in parallel bands, then columns in parallel bands
+    void build(const TileGrid &map, uint8_t value, ThreadPool *pool = nullptr);
+    void clear();
+
+    int getWidth() const { return width; }
+    int getHeight() const { return height; }
+    bool empty() const { return sums.empty(); }
+
+    // Matching cells in [x0, x1] x [y0, y1] (inclusive), clipped to the map
+    int count(int x0, int y0, int x1, int y1) const;
+
+    // Row y of the table (0..height), width + 1 entries, for scanning kernels
+    const uint32_t* row(int y) const { return &sums[(size_t)y * (width + 1)]; }
+};
+
+#endif // SUMMED_AREA_TABLE_H
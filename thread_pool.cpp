@@ -0,0 +1,120 @@
+#include "thread_pool.h"
+#include <atomic>
+#include <memory>
+#include <algorithm>
+
+ThreadPool* ThreadPool::instance = nullptr;
+static std::once_flag instanceOnce;
+
+ThreadPool::ThreadPool(int threads) : stopping(false) {
+    if (threads <= 0) {
+        threads = (int)std::thread::hardware_concurrency();
+        if (threads <= 0) threads = 1;
+    }
+    for (int i = 1; i < threads; i++) {
+        workers.push_back(std::thread(&ThreadPool::workerLoop, this));
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (size_t i = 0; i < workers.size(); i++) {
+        workers[i].join();
+    }
+}
+
+ThreadPool* ThreadPool::getInstance() {
+    // The generation worker and the main thread can both ask first. Never
+    // destroyed, so a job still running at exit keeps a live pool.
+    std::call_once(instanceOnce, [] { instance = new ThreadPool(); });
+    return instance;
+}
+
+void ThreadPool::workerLoop() {
+    for (;;) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [this] { return stopping || !tasks.empty(); });
+            if (stopping && tasks.empty()) return;
+            task = std::move(tasks.front());
+            tasks.pop_front();
+        }
+        task();
+    }
+}
+
+void ThreadPool::submit(const std::function<void()> &task) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        tasks.push_back(task);
+    }
+    wake.notify_one();
+}
+
+namespace {
+// Shared between the caller and its helpers; helpers that start after all
+// bands are taken only touch this and return
+struct ParallelForState {
+    std::function<void(int, int)> fn;
+    int begin;
+    int bandSize;
+    int bandCount;
+    std::atomic<int> nextBand;
+    std::atomic<int> doneBands;
+    std::mutex mutex;
+    std::condition_variable finished;
+
+    void run() {
+        for (;;) {
+            int band = nextBand.fetch_add(1);
+            if (band >= bandCount) return;
+            int b0 = begin + band * bandSize;
+            fn(b0, b0 + bandSize);
+            if (doneBands.fetch_add(1) + 1 == bandCount) {
+                std::lock_guard<std::mutex> lock(mutex);
+                finished.notify_all();
+            }
+        }
+    }
+};
+}
+
+void ThreadPool::parallelFor(int begin, int end, const std::function<void(int, int)> &fn,
+                             int minBand) {
+    int count = end - begin;
+    if (count <= 0) return;
+    minBand = std::max(1, minBand);
+
+    // A few bands per thread so uneven rows still balance
+    int threads = getThreadCount();
+    int bands = std::min(threads * 4, (count + minBand - 1) / minBand);
+    if (threads == 1 || bands <= 1) {
+        fn(begin, end);
+        return;
+    }
+    int bandSize = (count + bands - 1) / bands;
+    bands = (count + bandSize - 1) / bandSize;
+
+    // Last band may be short; clamp inside the callback wrapper
+    std::shared_ptr<ParallelForState> state = std::make_shared<ParallelForState>();
+    state->fn = [fn, end](int b0, int b1) { fn(b0, std::min(b1, end)); };
+    state->begin = begin;
+    state->bandSize = bandSize;
+    state->bandCount = bands;
+    state->nextBand = 0;
+    state->doneBands = 0;
+
+    int helpers = std::min(threads - 1, bands - 1);
+    for (int i = 0; i < helpers; i++) {
+        submit([state] { state->run(); });
+    }
+    state->run();
+
+    std::unique_lock<std::mutex> lock(state->mutex);
+    state->finished.wait(lock, [&state] { return state->doneBands.load() == state->bandCount; });
+}
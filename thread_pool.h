@@ -0,0 +1,44 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+// Fixed-size worker pool for data-parallel loops over rows/bands.
+class ThreadPool {
+private:
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> tasks;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping;
+    static ThreadPool *instance;
+
+    void workerLoop();
+
+public:
+    // threads <= 0 uses std::thread::hardware_concurrency(); the calling
+    // thread always takes part, so a pool of 1 runs everything inline
+    explicit ThreadPool(int threads = 0);
+    ~ThreadPool();
+
+    // Shared pool sized to the machine
+    static ThreadPool* getInstance();
+
+    int getThreadCount() const { return (int)workers.size() + 1; }
+
+    // Queue a task to run on a worker
+    void submit(const std::function<void()> &task);
+
+    // Split [begin, end) into bands of at least minBand items and call
+    // fn(bandBegin, bandEnd) for each, in parallel. Returns when all bands
+    // are done. Safe to call from inside another parallelFor.
+    void parallelFor(int begin, int end, const std::function<void(int, int)> &fn,
+                     int minBand = 1);
+};
+
+#endif // THREAD_POOL_H
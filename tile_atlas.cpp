@@ -0,0 +1,79 @@
+#include "tile_atlas.h"
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+
+TileAtlas::TileAtlas()
+    : tileWidth(16), tileHeight(16), margin(1), spacing(1), columns(0), rows(0) {
+}
+
+void TileAtlas::setLayout(int tileW, int tileH, int margin, int spacing) {
+    tileWidth = tileW;
+    tileHeight = tileH;
+    this->margin = margin;
+    this->spacing = spacing;
+}
+
+static std::string upperTrimmed(const std::string &text) {
+    size_t begin = text.find_first_not_of(" \t\r");
+    size_t end = text.find_last_not_of(" \t\r");
+    if (begin == std::string::npos) return "";
+    std::string result = text.substr(begin, end - begin + 1);
+    for (size_t i = 0; i < result.size(); i++) {
+        result[i] = (char)std::toupper((unsigned char)result[i]);
+    }
+    return result;
+}
+
+bool TileAtlas::loadInfo(const std::string &path) {
+    std::ifstream in(path.c_str());
+    if (!in) {
+        std::cerr << "Cannot open spritesheet info: " << path << std::endl;
+        return false;
+    }
+
+    int newWidth = -1, newHeight = -1, newMargin = -1, newSpacing = -1;
+    std::string line;
+    while (std::getline(in, line)) {
+        size_t colon = line.find(':');
+        if (colon == std::string::npos) continue;
+        std::string key = upperTrimmed(line.substr(0, colon));
+        std::string value = upperTrimmed(line.substr(colon + 1));
+        if (key == "TILE SIZE") {
+            if (std::sscanf(value.c_str(), "%d X %d", &newWidth, &newHeight) != 2) {
+                newWidth = newHeight = -1;
+            }
+        } else if (key == "MARGIN") {
+            std::sscanf(value.c_str(), "%d", &newMargin);
+        } else if (key == "SPACING") {
+            std::sscanf(value.c_str(), "%d", &newSpacing);
+        }
+    }
+
+    if (newWidth <= 0 || newHeight <= 0 || newMargin < 0) {
+        std::cerr << "Spritesheet info " << path << " needs TILE SIZE and MARGIN" << std::endl;
+        return false;
+    }
+    setLayout(newWidth, newHeight, newMargin, newSpacing >= 0 ? newSpacing : newMargin);
+    return true;
+}
+
+void TileAtlas::build(int textureWidth, int textureHeight) {
+    // Tiles that fit entirely inside the sheet
+    columns = std::max(0, (textureWidth - margin + spacing) / (tileWidth + spacing));
+    rows = std::max(0, (textureHeight - margin + spacing) / (tileHeight + spacing));
+    columns = std::min(columns, (int)NO_TILE / std::max(1, rows));
+
+    rects.resize((size_t)columns * rows);
+    for (int row = 0; row < rows; row++) {
+        for (int col = 0; col < columns; col++) {
+            SDL_Rect &r = rects[(size_t)row * columns + col];
+            r.x = margin + col * (tileWidth + spacing);
+            r.y = margin + row * (tileHeight + spacing);
+            r.w = tileWidth;
+            r.h = tileHeight;
+        }
+    }
+}
@@ -0,0 +1,50 @@
+#ifndef TILE_ATLAS_H
+#define TILE_ATLAS_H
+
+#include <SDL2/SDL.h>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Spritesheet tile id (row-major over the sheet)
+typedef uint16_t TileId;
+static const TileId NO_TILE = 0xFFFF;
+
+// Where each tile of a spritesheet lives. The layout comes from an info
+// file next to the sheet, the size from the texture itself; the source
+// rect of every tile id is computed once so drawing is a table lookup.
+//
+// Info file keys (anything else is ignored):
+//   TILE SIZE: 16 x 16
+//   MARGIN: 1      border before the first tile
+//   SPACING: 1     gap between tiles (defaults to MARGIN)
+class TileAtlas {
+private:
+    int tileWidth;
+    int tileHeight;
+    int margin;
+    int spacing;
+    int columns;
+    int rows;
+    std::vector<SDL_Rect> rects;   // tile id -> source rect
+
+public:
+    TileAtlas();
+
+    void setLayout(int tileW, int tileH, int margin, int spacing);
+    // Read the layout from an info file; on failure the layout is unchanged
+    bool loadInfo(const std::string &path);
+
+    // Compute the rect table for a sheet of this size
+    void build(int textureWidth, int textureHeight);
+
+    int getTileWidth() const { return tileWidth; }
+    int getTileHeight() const { return tileHeight; }
+    int getColumns() const { return columns; }
+    int getRows() const { return rows; }
+    int getTileCount() const { return (int)rects.size(); }
+    bool contains(int id) const { return id >= 0 && id < (int)rects.size(); }
+    const SDL_Rect& rect(TileId id) const { return rects[id]; }
+};
+
+#endif // TILE_ATLAS_H
@@ -1,16 +1,82 @@
 #include "tilemap.h"
+#include "tilemap_file.h"
+#include "thread_pool.h"
 #include <SDL2/SDL_image.h>
+#include <memory>
 #include <iostream>
 #include <cmath>
 #include <algorithm>
+#include <climits>
+
+const int Tilemap::MAX_PALETTE_SIZE;
+const int Tilemap::BLOCK_TILES;
+const int Tilemap::STREAM_MAP_HEIGHT;
+
+// True if every cell names an entry of a palette of paletteSize entries
+static bool cellsInPalette(const uint8_t *cells, size_t count, size_t paletteSize) {
+    if (paletteSize > UINT8_MAX) return true;
+    for (size_t i = 0; i < count; i++) {
+        if (cells[i] >= paletteSize) return false;
+    }
+    return true;
+}
+
+static bool cellsInPalette(const SparseTileGrid &cells, size_t paletteSize) {
+    int size = SparseTileGrid::CHUNK_SIZE;
+    for (int y0 = 0; y0 < cells.getHeight(); y0 += size) {
+        for (int x0 = 0; x0 < cells.getWidth(); x0 += size) {
+            uint8_t value;
+            if (cells.isUniform(x0, y0, value)) {
+                if (!cellsInPalette(&value, 1, paletteSize)) return false;
+                continue;
+            }
+            int columns = std::min(size, cells.getWidth() - x0);
+            for (int y = y0; y < std::min(y0 + size, cells.getHeight()); y++) {
+                if (!cellsInPalette(cells.span(x0, y), columns, paletteSize)) return false;
+            }
+        }
+    }
+    return true;
+}
 
 Tilemap::Tilemap(SDL_Renderer *renderer, const std::string &imagePath,
                  int tileW, int tileH, int mapW, int mapH)
     : spritesheet(nullptr), renderer(renderer), tileWidth(tileW), tileHeight(tileH),
-      mapWidth(mapW), mapHeight(mapH), spritesheetCols(0), spritesheetRows(0) {
+      mapWidth(mapW), mapHeight(mapH), sheetWidth(0), sheetHeight(0), autotileWall(-1), chunkSize(0), blocksAcross(0), blocksDown(0), mapReplaced(true),
+      minimapLevelCount(0), minimapTexture(nullptr), minimapPitch(0), minimapStale(true), minimapFailed(false), lodZoom(DEFAULT_LOD_ZOOM),
+      animatedCellCount(0), animationIndexStale(true), renderCacheBudget(DEFAULT_RENDER_CACHE_BYTES),
+      renderFrame(0), renderMode(RENDER_TILES), renderChunkBlend(SDL_BLENDMODE_BLEND) {
     
     // Initialize tilemap with zeros
-    tiles.resize(mapHeight, std::vector<int>(mapWidth, 0));
+    atlas.setLayout(tileW, tileH, 1, 1);
+    solidTileIds.push_back(0);
+    solidTileIds.push_back(4);
+    palette.assign(1, 0);
+    updatePaletteEntry(0);
+    tiles.resize(mapWidth, mapHeight, 0);
+    solidity.resize(mapWidth, mapHeight);
+    rebuildSolidity(0, mapHeight);
+    
+    // Baked blocks hold premultiplied colour (tiles are blended onto a
+    // transparent target), so they are drawn with a premultiplied blend
+    if (renderer && SDL_RenderTargetSupported(renderer)) {
+        renderMode = RENDER_CACHED_BLOCKS;
+    } else {
+#ifdef HAVE_RENDER_GEOMETRY
+        renderMode = RENDER_GEOMETRY;
+#endif
+    }
+#ifdef HAVE_RENDER_GEOMETRY
+    geometryRange = SDL_Rect{ 0, 0, 0, 0 };
+    geometryValid = false;
+    geometryOffsetX = 0.0f;
+    geometryOffsetY = 0.0f;
+    geometryZoom = 1.0f;
+#endif
+    renderChunkBlend = SDL_ComposeCustomBlendMode(
+        SDL_BLENDFACTOR_ONE, SDL_BLENDFACTOR_ONE_MINUS_SRC_ALPHA, SDL_BLENDOPERATION_ADD,
+        SDL_BLENDFACTOR_ONE, SDL_BLENDFACTOR_ONE_MINUS_SRC_ALPHA, SDL_BLENDOPERATION_ADD);
+    resetBlocks();
     
     // Load spritesheet
     if (!loadSpritesheet(imagePath)) {
@@ -19,6 +85,12 @@ Tilemap::Tilemap(SDL_Renderer *renderer, const std::string &imagePath,
 }
 
 Tilemap::~Tilemap() {
+    for (size_t i = 0; i < renderChunks.size(); i++) {
+        SDL_DestroyTexture(renderChunks[i].texture);
+    }
+    if (minimapTexture) {
+        SDL_DestroyTexture(minimapTexture);
+    }
     if (spritesheet) {
         SDL_DestroyTexture(spritesheet);
     }
@@ -40,23 +112,41 @@ bool Tilemap::loadSpritesheet(const std::string &imagePath) {
     }
     
     // Create texture from surface
+    if (spritesheet) {
+        SDL_DestroyTexture(spritesheet);
+    }
     spritesheet = SDL_CreateTextureFromSurface(renderer, surface);
-    SDL_FreeSurface(surface);
-    
     if (!spritesheet) {
         std::cerr << "SDL_CreateTextureFromSurface failed: " << SDL_GetError() << std::endl;
+        SDL_FreeSurface(surface);
         return false;
     }
     
-    // Calculate number of tiles in spritesheet
-    // For 492x305 image with 16x16 tiles and 1px margin:
-    // cols = (492 - margin) / (16 + margin) = 491 / 17 = 28
-    // rows = (305 - margin) / (16 + margin) = 304 / 17 = 17
-    spritesheetCols = (492 - TILE_MARGIN) / (tileWidth + TILE_MARGIN);
-    spritesheetRows = (305 - TILE_MARGIN) / (tileHeight + TILE_MARGIN);
+    // Tile layout from the info file, sheet size from the texture:
+    // 492x305 with 16x16 tiles and a 1px margin gives 28x17 tiles
+    size_t slash = imagePath.find_last_of("/\\");
+    std::string directory = slash == std::string::npos ? "" : imagePath.substr(0, slash + 1);
+    atlas.loadInfo(directory + "spritesheetInfo.txt");
+    if (SDL_QueryTexture(spritesheet, nullptr, nullptr, &sheetWidth, &sheetHeight) != 0) {
+        std::cerr << "SDL_QueryTexture failed: " << SDL_GetError() << std::endl;
+        SDL_FreeSurface(surface);
+        return false;
+    }
+    atlas.build(sheetWidth, sheetHeight);
+    computeTileColours(surface);
+    SDL_FreeSurface(surface);
+    for (size_t i = 0; i < palette.size(); i++) {
+        updatePaletteEntry((int)i);
+    }
+    for (size_t l = 0; l < layers.size(); l++) {
+        for (size_t i = 0; i < layers[l].palette.size(); i++) {
+            updateLayerRect(layers[l], (int)i);
+        }
+    }
+    markMapReplaced();
     
-    std::cout << "Spritesheet loaded: " << spritesheetCols << "x" << spritesheetRows 
-              << " tiles (" << spritesheetCols * spritesheetRows << " total)" << std::endl;
+    std::cout << "Spritesheet loaded: " << atlas.getColumns() << "x" << atlas.getRows()
+              << " tiles (" << atlas.getTileCount() << " total)" << std::endl;
     
     return true;
 }
@@ -70,108 +160,1649 @@ bool Tilemap::loadMapFromArray(const int *mapData) {
     int idx = 0;
     for (int y = 0; y < mapHeight; y++) {
         for (int x = 0; x < mapWidth; x++) {
-            tiles[y][x] = mapData[idx++];
+            setTile(x, y, mapData[idx++]);
         }
     }
     
     return true;
 }
 
+bool Tilemap::loadMap(TileGrid &&cells, const std::vector<int> &cellPalette) {
+    if (cells.getWidth() != mapWidth || cells.getHeight() != mapHeight) {
+        std::cerr << "Map size " << cells.getWidth() << "x" << cells.getHeight()
+                  << " does not match tilemap " << mapWidth << "x" << mapHeight << std::endl;
+        return false;
+    }
+    if (!cellsInPalette(cells.data(), cells.size(), cellPalette.size())) {
+        std::cerr << "Map has cells past the " << cellPalette.size() << "-entry palette" << std::endl;
+        return false;
+    }
+    if (!setPalette(cellPalette)) {
+        return false;
+    }
+    
+    // Compress, then release the dense grid
+    tiles = SparseTileGrid(cells);
+    cells = TileGrid();
+    chunkSource = nullptr;
+    slotChunkRow.clear();
+    rebuildSolidity(0, mapHeight);
+    markMapReplaced();
+    retileAll();
+    return true;
+}
+
+bool Tilemap::loadMap(SparseTileGrid &&cells, const std::vector<int> &cellPalette) {
+    if (cells.getWidth() != mapWidth || cells.getHeight() != mapHeight) {
+        std::cerr << "Map size " << cells.getWidth() << "x" << cells.getHeight()
+                  << " does not match tilemap " << mapWidth << "x" << mapHeight << std::endl;
+        return false;
+    }
+    if (!cellsInPalette(cells, cellPalette.size())) {
+        std::cerr << "Map has cells past the " << cellPalette.size() << "-entry palette" << std::endl;
+        return false;
+    }
+    if (!setPalette(cellPalette)) {
+        return false;
+    }
+    
+    tiles = std::move(cells);
+    chunkSource = nullptr;
+    slotChunkRow.clear();
+    rebuildSolidity(0, mapHeight);
+    markMapReplaced();
+    retileAll();
+    return true;
+}
+
+bool Tilemap::enableStreaming(const ChunkSource &source, const std::vector<int> &cellPalette,
+                              int chunkSize, int residentChunkRows, int height) {
+    if (!source || chunkSize <= 0 || height < 0) {
+        std::cerr << "Invalid chunk size " << chunkSize << " or height " << height << std::endl;
+        return false;
+    }
+    if (residentChunkRows < 3) {
+        std::cerr << "Streaming needs at least 3 resident chunk rows" << std::endl;
+        return false;
+    }
+    if (!setPalette(cellPalette)) {
+        return false;
+    }
+    
+    chunkSource = source;
+    this->chunkSize = chunkSize;
+    mapHeight = height > 0 ? height : STREAM_MAP_HEIGHT - STREAM_MAP_HEIGHT % chunkSize;
+    tiles.resize(mapWidth, residentChunkRows * chunkSize, 0);
+    solidity.resize(mapWidth, tiles.getHeight());
+    rebuildSolidity(0, tiles.getHeight());
+    slotChunkRow.assign(residentChunkRows, -1);
+    resetBlocks();
+    return true;
+}
+
+void Tilemap::loadChunkRow(int chunkRow) {
+    int slot = chunkRow % (int)slotChunkRow.size();
+    if (slotChunkRow[slot] == chunkRow) return;
+    int evicted = slotChunkRow[slot];
+    slotChunkRow[slot] = -1;
+    if (evicted >= 0) {
+        markRowsChanged(evicted * chunkSize, (evicted + 1) * chunkSize - 1);
+        indexAnimatedRows(evicted * chunkSize, (evicted + 1) * chunkSize);
+    }
+    markRowsChanged(chunkRow * chunkSize, (chunkRow + 1) * chunkSize - 1);
+    markMinimapRows(slot * chunkSize, (slot + 1) * chunkSize);
+    
+    // The last chunk column may reach past the map edge
+    for (int cx = 0; cx * chunkSize < mapWidth; cx++) {
+        int columns = std::min(chunkSize, mapWidth - cx * chunkSize);
+        chunkSource(cx, chunkRow, chunkScratch);
+        if (chunkScratch.getWidth() != chunkSize || chunkScratch.getHeight() != chunkSize) {
+            std::cerr << "Chunk source returned " << chunkScratch.getWidth() << "x"
+                      << chunkScratch.getHeight() << ", expected " << chunkSize << std::endl;
+            return;
+        }
+        // Cells naming no palette entry would index past its end
+        if (!cellsInPalette(chunkScratch.data(), chunkScratch.size(), palette.size())) {
+            uint8_t *cell = chunkScratch.data();
+            for (size_t i = 0; i < chunkScratch.size(); i++) {
+                if (cell[i] >= palette.size()) cell[i] = 0;
+            }
+            std::cerr << "Chunk " << cx << "," << chunkRow << " has cells past the palette" << std::endl;
+        }
+        for (int y = 0; y < chunkSize; y++) {
+            tiles.setRow(cx * chunkSize, slot * chunkSize + y, chunkScratch.row(y), columns);
+        }
+    }
+    // Whatever the previous row left mixed may be uniform now
+    tiles.compact(slot * chunkSize, (slot + 1) * chunkSize);
+    rebuildSolidity(slot * chunkSize, (slot + 1) * chunkSize);
+    slotChunkRow[slot] = chunkRow;
+    indexAnimatedRows(chunkRow * chunkSize, (chunkRow + 1) * chunkSize);
+    
+    // The rows, and the edges of their neighbours, were tiled without them
+    if (autotileWall >= 0) {
+        retile(0, chunkRow * chunkSize - 1, mapWidth - 1, (chunkRow + 1) * chunkSize);
+    }
+}
+
+void Tilemap::streamAround(float cameraX, float cameraY, int screenWidth, int screenHeight) {
+    (void)cameraX;
+    (void)screenWidth;
+    if (!isStreaming()) return;
+    
+    // Chunk rows span the full map width, so only the vertical range matters
+    int chunkRows = (mapHeight + chunkSize - 1) / chunkSize;
+    int first = (int)std::floor(cameraY / tileHeight) / chunkSize - 1;
+    int last = (int)std::floor((cameraY + screenHeight) / tileHeight) / chunkSize + 1;
+    first = std::max(0, first);
+    last = std::min(chunkRows - 1, std::min(last, first + (int)slotChunkRow.size() - 1));
+    
+    for (int cy = first; cy <= last; cy++) {
+        loadChunkRow(cy);
+    }
+}
+
+bool Tilemap::openMapFile(const std::string &path, int residentChunkRows) {
+    // The source shares ownership, so the mapping lives as long as it does
+    std::shared_ptr<TilemapFile> file = std::make_shared<TilemapFile>();
+    if (!file->open(path)) {
+        return false;
+    }
+    ChunkSource source = [file](int chunkX, int chunkY, TileGrid &chunk) {
+        file->readChunk(chunkX, chunkY, chunk);
+    };
+    
+    int oldWidth = mapWidth;
+    mapWidth = file->getWidth();
+    if (!enableStreaming(source, file->getPalette(), file->getChunkSize(),
+                         residentChunkRows, file->getHeight())) {
+        mapWidth = oldWidth;
+        return false;
+    }
+    std::cout << "Opened " << path << ": " << mapWidth << "x" << mapHeight << " tiles in "
+              << file->getChunksAcross() * file->getChunksDown() << " chunks, "
+              << file->getFileSize() << " bytes" << std::endl;
+    return true;
+}
+
+bool Tilemap::saveMap(const std::string &path, int chunkSize) const {
+    if (isStreaming()) {
+        std::cerr << "Cannot save a streamed map" << std::endl;
+        return false;
+    }
+    std::vector<int> tileIds(palette.size());
+    for (size_t i = 0; i < palette.size(); i++) {
+        tileIds[i] = palette[i] == NO_TILE ? -1 : palette[i];
+    }
+    return TilemapFile::save(path, tiles, tileIds, chunkSize);
+}
+
+int Tilemap::mapRow(int row) const {
+    if (slotChunkRow.empty()) return row;
+    int chunkRow = slotChunkRow[row / chunkSize];
+    return chunkRow < 0 ? -1 : chunkRow * chunkSize + row % chunkSize;
+}
+
+int Tilemap::storageRow(int y) const {
+    if (slotChunkRow.empty()) return y;
+    int chunkRow = y / chunkSize;
+    int slot = chunkRow % (int)slotChunkRow.size();
+    if (slotChunkRow[slot] != chunkRow) return -1;
+    return slot * chunkSize + y % chunkSize;
+}
+
+int Tilemap::paletteIndex(int tileIndex) {
+    TileId id = (tileIndex < 0 || tileIndex >= NO_TILE) ? NO_TILE : (TileId)tileIndex;
+    for (size_t i = 0; i < palette.size(); i++) {
+        if (palette[i] == id) return (int)i;
+    }
+    if ((int)palette.size() >= MAX_PALETTE_SIZE) {
+        std::cerr << "Tile palette full, cannot add tile " << tileIndex << std::endl;
+        return -1;
+    }
+    palette.push_back(id);
+    updatePaletteEntry((int)palette.size() - 1);
+    return (int)palette.size() - 1;
+}
+
+bool Tilemap::setPalette(const std::vector<int> &cellPalette) {
+    if (cellPalette.empty() || (int)cellPalette.size() > MAX_PALETTE_SIZE) {
+        std::cerr << "Invalid palette size: " << cellPalette.size() << std::endl;
+        return false;
+    }
+    palette.resize(cellPalette.size());
+    for (size_t i = 0; i < cellPalette.size(); i++) {
+        int tileIndex = cellPalette[i];
+        palette[i] = (tileIndex < 0 || tileIndex >= NO_TILE) ? NO_TILE : (TileId)tileIndex;
+        updatePaletteEntry((int)i);
+    }
+    refreshAutotilePalette();
+    return true;
+}
+
+void Tilemap::updatePaletteEntry(int index) {
+    // Ids outside the sheet draw nothing
+    SDL_Rect none = { 0, 0, 0, 0 };
+    paletteAnimation[index] = -1;
+    for (size_t i = 0; i < animations.size(); i++) {
+        if (animations[i].tile == palette[index]) paletteAnimation[index] = (int)i;
+    }
+    TileId shown = palette[index];
+    if (paletteAnimation[index] >= 0) {
+        const TileAnimation &animation = animations[paletteAnimation[index]];
+        shown = animation.frames[animation.current];
+    }
+    paletteRects[index] = atlas.contains(shown) ? atlas.rect(shown) : none;
+    paletteSolid[index] = std::find(solidTileIds.begin(), solidTileIds.end(),
+                                    (int)palette[index]) != solidTileIds.end();
+    paletteColours[index] = palette[index] < tileColours.size() ? tileColours[palette[index]] : 0;
+    paletteWall[index] = autotileWall >= 0 && palette[index] != NO_TILE &&
+                         ((int)palette[index] == autotileWall || autotiler.isVariantTile(palette[index]));
+}
+
+void Tilemap::drawCell(const SDL_Rect *rects, uint8_t cell, int x, int y, int w, int h) {
+    const SDL_Rect &srcRect = rects[cell];
+    if (srcRect.w == 0) return; // Skip invalid tiles
+    SDL_Rect dstRect = { x, y, w, h };
+    SDL_RenderCopy(renderer, spritesheet, &srcRect, &dstRect);
+}
+
 void Tilemap::render(float offsetX, float offsetY) {
     if (!spritesheet) return;
+#ifdef HAVE_RENDER_GEOMETRY
+    // Batch only what lands on the output; without its size, draw per tile
+    int screenWidth, screenHeight;
+    if (renderMode == RENDER_GEOMETRY &&
+        SDL_GetRendererOutputSize(renderer, &screenWidth, &screenHeight) == 0 &&
+        renderGeometry(-offsetX, -offsetY,
+                       geometryRangeFor(-offsetX, -offsetY, screenWidth, screenHeight, 1.0f), 1.0f)) {
+        return;
+    }
+#endif
     
     for (int y = 0; y < mapHeight; y++) {
+        int row = storageRow(y);
+        if (row < 0) continue;
         for (int x = 0; x < mapWidth; x++) {
-            int tileIndex = tiles[y][x];
-            if (tileIndex < 0) continue; // Skip invalid tiles
-            
-            // Calculate which tile in spritesheet
-            int spriteCol = tileIndex % spritesheetCols;
-            int spriteRow = tileIndex / spritesheetCols;
-            
-            // Source rectangle in spritesheet
-            SDL_Rect srcRect = {
-                spriteCol * (tileWidth + TILE_MARGIN) + TILE_MARGIN,
-                spriteRow * (tileHeight + TILE_MARGIN) + TILE_MARGIN,
-                tileWidth,
-                tileHeight
-            };
-            
-            // Destination rectangle on screen
-            SDL_Rect dstRect = {
-                (int)(offsetX + x * tileWidth),
-                (int)(offsetY + y * tileHeight),
-                tileWidth,
-                tileHeight
-            };
-            
-            SDL_RenderCopy(renderer, spritesheet, &srcRect, &dstRect);
+            drawCell(paletteRects, tiles.get(x, row), (int)(offsetX + x * tileWidth), (int)(offsetY + y * tileHeight),
+                     tileWidth, tileHeight);
         }
     }
 }
 
 void Tilemap::setTile(int x, int y, int tileIndex) {
     if (x >= 0 && x < mapWidth && y >= 0 && y < mapHeight) {
-        tiles[y][x] = tileIndex;
+        int row = storageRow(y);
+        if (row < 0) return;
+        int index = paletteIndex(tileIndex);
+        if (index < 0 || tiles.get(x, row) == index) return;
+        if (autotileWall >= 0 && paletteWall[index] && paletteWall[tiles.get(x, row)]) {
+            return;     // still a wall, already showing the right variant
+        }
+        writeCell(x, y, row, (uint8_t)index);
+        if (autotileWall >= 0) {
+            retile(x - 1, y - 1, x + 1, y + 1);
+        }
+    }
+}
+
+void Tilemap::writeCell(int x, int y, int row, uint8_t index) {
+    bool wasAnimated = paletteAnimation[tiles.get(x, row)] >= 0;
+    if (wasAnimated != (paletteAnimation[index] >= 0)) {
+        indexAnimatedCell(x, y, !wasAnimated);
+    }
+    tiles.set(x, row, index);
+    if (paletteSolid[index]) {
+        solidity.set(x, row);
+    } else {
+        solidity.reset(x, row);
     }
+    markBlockChanged((y / BLOCK_TILES) * blocksAcross + x / BLOCK_TILES);
+    markMinimapChanged(x, row);
+#ifdef HAVE_RENDER_GEOMETRY
+    if (x >= geometryRange.x && x < geometryRange.x + geometryRange.w &&
+        y >= geometryRange.y && y < geometryRange.y + geometryRange.h) {
+        geometryValid = false;
+    }
+#endif
 }
 
 int Tilemap::getTile(int x, int y) const {
     if (x >= 0 && x < mapWidth && y >= 0 && y < mapHeight) {
-        return tiles[y][x];
+        int row = storageRow(y);
+        if (row >= 0 && palette[tiles.get(x, row)] != NO_TILE) return palette[tiles.get(x, row)];
     }
     return -1;
 }
 
 void Tilemap::clear() {
-    for (int y = 0; y < mapHeight; y++) {
-        for (int x = 0; x < mapWidth; x++) {
-            tiles[y][x] = 0;
+    if (isStreaming()) {
+        // Drop resident rows; they are regenerated on the next streamAround
+        std::fill(slotChunkRow.begin(), slotChunkRow.end(), -1);
+        markMapReplaced();
+        return;
+    }
+    palette.assign(1, 0);
+    updatePaletteEntry(0);
+    refreshAutotilePalette();
+    tiles.fill(0);
+    rebuildSolidity(0, mapHeight);
+    markMapReplaced();
+    retileAll();
+}
+
+void Tilemap::renderViewport(float cameraX, float cameraY, int screenWidth, int screenHeight, float zoom) {
+    if (!spritesheet || renderChunkSlot.empty() || zoom <= 0.0f) return;
+    renderFrame++;
+    if (zoom < lodZoom && !minimapFailed &&
+        renderViewportLod(cameraX, cameraY, screenWidth, screenHeight, zoom)) {
+        return;
+    }
+    renderLayers(INT_MIN, -1, cameraX, cameraY, screenWidth, screenHeight, zoom);
+    if (renderMode == RENDER_CACHED_BLOCKS) {
+        renderViewportBlocks(0, cameraX, cameraY, screenWidth, screenHeight, zoom);
+        return;
+    }
+#ifdef HAVE_RENDER_GEOMETRY
+    if (renderMode == RENDER_GEOMETRY) {
+        SDL_Rect range = geometryRangeFor(cameraX, cameraY, screenWidth, screenHeight, zoom);
+        if (renderGeometry(cameraX, cameraY, range, zoom)) return;
+        std::cerr << "SDL_RenderGeometry failed, drawing tiles directly: " << SDL_GetError() << std::endl;
+        renderMode = RENDER_TILES;
+    }
+#endif
+    renderViewportTiles(0, cameraX, cameraY, screenWidth, screenHeight, zoom);
+}
+
+void Tilemap::renderOverlays(float cameraX, float cameraY, int screenWidth, int screenHeight, float zoom) {
+    if (!spritesheet || renderChunkSlot.empty() || (zoom < lodZoom && !minimapFailed)) return;
+    // Same frame as renderViewport: blocks it drew stay cached
+    renderLayers(0, INT_MAX, cameraX, cameraY, screenWidth, screenHeight, zoom);
+}
+
+bool Tilemap::renderViewportLod(float cameraX, float cameraY, int screenWidth, int screenHeight, float zoom) {
+    if (minimapLevelCount == 0) {
+        enableMinimap();
+    }
+    int levels = getMinimapLevelCount();
+    if (levels == 0) return false;
+    // The level whose pixels come closest to one screen pixel without
+    // getting smaller; the copy scales it the rest of the way
+    int level = 0;
+    while (level + 1 < levels && tileWidth * zoom * (2 << level) <= 1.0f) {
+        level++;
+    }
+    
+    // Tiles touching the view, placed the way the full-detail paths would
+    int startX = (int)std::floor(cameraX / tileWidth);
+    int startY = (int)std::floor(cameraY / tileHeight);
+    int endX = (int)std::floor((cameraX + screenWidth / zoom) / tileWidth) + 1;
+    int endY = (int)std::floor((cameraY + screenHeight / zoom) / tileHeight) + 1;
+    SDL_Rect area = { startX, startY, endX - startX, endY - startY };
+    int dstX0 = (int)std::floor((startX * tileWidth - cameraX) * zoom);
+    int dstY0 = (int)std::floor((startY * tileHeight - cameraY) * zoom);
+    int dstX1 = (int)std::floor((endX * tileWidth - cameraX) * zoom);
+    int dstY1 = (int)std::floor((endY * tileHeight - cameraY) * zoom);
+    SDL_Rect dst = { dstX0, dstY0, dstX1 - dstX0, dstY1 - dstY0 };
+    return renderMinimap(level, &area, dst);
+}
+
+void Tilemap::renderLayers(int minDepth, int maxDepth, float cameraX, float cameraY,
+                           int screenWidth, int screenHeight, float zoom) {
+    for (size_t i = 0; i < layerOrder.size(); i++) {
+        int id = layerOrder[i];
+        const TileLayer &layer = layers[id - 1];
+        if (layer.depth < minDepth || layer.depth > maxDepth || !layer.visible || layer.opacity == 0) {
+            continue;
+        }
+        float layerX = cameraX * layer.parallax;
+        float layerY = cameraY * layer.parallax;
+        if (renderMode == RENDER_CACHED_BLOCKS) {
+            renderViewportBlocks(id, layerX, layerY, screenWidth, screenHeight, zoom);
+        } else {
+            renderViewportTiles(id, layerX, layerY, screenWidth, screenHeight, zoom);
         }
     }
 }
 
-void Tilemap::renderViewport(float cameraX, float cameraY, int screenWidth, int screenHeight) {
-    if (!spritesheet) return;
+void Tilemap::renderViewportBlocks(int layer, float cameraX, float cameraY, int screenWidth, int screenHeight,
+                                   float zoom) {
+    Uint8 opacity = layer > 0 ? layers[layer - 1].opacity : 255;
     
+    // Visible blocks, clamped to the map
+    int blockWidth = BLOCK_TILES * tileWidth;
+    int blockHeight = BLOCK_TILES * tileHeight;
+    int startX = std::max(0, (int)std::floor(cameraX / blockWidth));
+    int startY = std::max(0, (int)std::floor(cameraY / blockHeight));
+    int endX = std::min(blocksAcross - 1, (int)std::floor((cameraX + screenWidth / zoom) / blockWidth));
+    int endY = std::min(blocksDown - 1, (int)std::floor((cameraY + screenHeight / zoom) / blockHeight));
+    
+    bool outOfTextures = false;
+    for (int by = startY; by <= endY; by++) {
+        for (int bx = startX; bx <= endX; bx++) {
+            int block = by * blocksAcross + bx;
+            if (isBlockEmpty(layer, block)) continue;
+            RenderChunk *entry = outOfTextures ? nullptr : acquireRenderChunk(layer, block);
+            if (!entry) {
+                // Out of textures; the blocks already drawn stay, the rest
+                // of this frame goes tile by tile so nothing is drawn twice
+                outOfTextures = true;
+                SDL_Rect range = { bx * BLOCK_TILES, by * BLOCK_TILES, BLOCK_TILES, BLOCK_TILES };
+                renderTiles(layer, cameraX, cameraY, range, zoom);
+                continue;
+            }
+            if (entry->dirty) {
+                bakeRenderChunk(*entry);
+            }
+            
+            // floor keeps block edges on the same pixels as per-tile drawing,
+            // and scaled blocks meet without gaps
+            int x0 = (int)std::floor(((float)(bx * blockWidth) - cameraX) * zoom);
+            int y0 = (int)std::floor(((float)(by * blockHeight) - cameraY) * zoom);
+            int x1 = (int)std::floor(((float)((bx + 1) * blockWidth) - cameraX) * zoom);
+            int y1 = (int)std::floor(((float)((by + 1) * blockHeight) - cameraY) * zoom);
+            SDL_Rect dstRect = { x0, y0, x1 - x0, y1 - y0 };
+            // Textures move between layers, so always set the fade. Baked
+            // colour is premultiplied and has to fade along with alpha.
+            SDL_SetTextureAlphaMod(entry->texture, opacity);
+            if (renderChunkBlend != SDL_BLENDMODE_BLEND) {
+                SDL_SetTextureColorMod(entry->texture, opacity, opacity, opacity);
+            }
+            SDL_RenderCopy(renderer, entry->texture, nullptr, &dstRect);
+        }
+    }
+}
+
+void Tilemap::renderViewportTiles(int layer, float cameraX, float cameraY, int screenWidth, int screenHeight,
+                                  float zoom) {
     // Calculate visible tile range
     int startX = (int)(cameraX / tileWidth);
     int startY = (int)(cameraY / tileHeight);
-    int endX = startX + (screenWidth / tileWidth) + 2;
-    int endY = startY + (screenHeight / tileHeight) + 2;
-    
+    int endX = startX + (int)(screenWidth / zoom / tileWidth) + 2;
+    int endY = startY + (int)(screenHeight / zoom / tileHeight) + 2;
+    SDL_Rect range = { startX, startY, endX - startX, endY - startY };
+    renderTiles(layer, cameraX, cameraY, range, zoom);
+}
+
+void Tilemap::renderTiles(int layer, float cameraX, float cameraY, const SDL_Rect &range, float zoom) {
     // Clamp to map boundaries
-    startX = std::max(0, startX);
-    startY = std::max(0, startY);
-    endX = std::min(mapWidth, endX);
-    endY = std::min(mapHeight, endY);
+    int startX = std::max(0, range.x);
+    int startY = std::max(0, range.y);
+    int endX = std::min(mapWidth, range.x + range.w);
+    int endY = std::min(mapHeight, range.y + range.h);
+    
+    const SparseTileGrid &cells = layerCells(layer);
+    const std::vector<TileId> &ids = layerPalette(layer);
+    const SDL_Rect *rects = layerRects(layer);
+    Uint8 opacity = layer > 0 ? layers[layer - 1].opacity : 255;
+    if (opacity != 255) SDL_SetTextureAlphaMod(spritesheet, opacity);
     
     for (int y = startY; y < endY; y++) {
-        for (int x = startX; x < endX; x++) {
-            int tileIndex = tiles[y][x];
-            if (tileIndex < 0) continue;
-            
-            // Calculate which tile in spritesheet
-            int spriteCol = tileIndex % spritesheetCols;
-            int spriteRow = tileIndex / spritesheetCols;
+        int row = layerRow(layer, y);
+        if (row < 0) continue;
+        for (int x = startX; x < endX; ) {
+            // Skip the rest of a storage chunk that draws nothing
+            int spanEnd = std::min(endX, x + SparseTileGrid::spanLength(x));
+            uint8_t value;
+            if (cells.isUniform(x, row, value) && ids[value] == NO_TILE) {
+                x = spanEnd;
+                continue;
+            }
+            // Destination on screen (accounting for camera and zoom); each
+            // tile ends where the next starts
+            int top = (int)std::floor((y * tileHeight - cameraY) * zoom);
+            int bottom = (int)std::floor(((y + 1) * tileHeight - cameraY) * zoom);
+            int left = (int)std::floor((x * tileWidth - cameraX) * zoom);
+            for (; x < spanEnd; x++) {
+                int right = (int)std::floor(((x + 1) * tileWidth - cameraX) * zoom);
+                drawCell(rects, cells.get(x, row), left, top, right - left, bottom - top);
+                left = right;
+            }
+        }
+    }
+    if (opacity != 255) SDL_SetTextureAlphaMod(spritesheet, 255);
+}
+
+bool Tilemap::setRenderMode(TileRenderMode mode) {
+    if (mode == RENDER_CACHED_BLOCKS && !(renderer && SDL_RenderTargetSupported(renderer))) {
+        std::cerr << "Renderer does not support render targets" << std::endl;
+        return false;
+    }
+#ifndef HAVE_RENDER_GEOMETRY
+    if (mode == RENDER_GEOMETRY) {
+        std::cerr << "SDL_RenderGeometry needs SDL 2.0.18 or newer" << std::endl;
+        return false;
+    }
+#endif
+    renderMode = mode;
+    return true;
+}
+
+#ifdef HAVE_RENDER_GEOMETRY
+void Tilemap::buildGeometry(const SDL_Rect &range) {
+    geometryVertices.clear();
+    geometryBase.clear();
+    geometryIndices.clear();
+    geometryAnimated.clear();
+    geometryRange = range;
+    geometryValid = true;
+    geometryOffsetX = 0.0f;
+    geometryOffsetY = 0.0f;
+    geometryZoom = 1.0f;
+    
+    if (sheetWidth <= 0 || sheetHeight <= 0) return;
+    float texelU = 1.0f / sheetWidth;
+    float texelV = 1.0f / sheetHeight;
+    SDL_Color white = { 255, 255, 255, 255 };
+    
+    for (int y = range.y; y < range.y + range.h; y++) {
+        int row = storageRow(y);
+        if (row < 0) continue;
+        for (int x = range.x; x < range.x + range.w; x++) {
+            // Skip the rest of a storage chunk that draws nothing
+            uint8_t value;
+            if (tiles.isUniform(x, row, value) && palette[value] == NO_TILE) {
+                x += SparseTileGrid::spanLength(x) - 1;
+                continue;
+            }
+            uint8_t cell = tiles.get(x, row);
+            const SDL_Rect &src = paletteRects[cell];
+            if (src.w == 0) continue;
             
-            // Source rectangle in spritesheet
-            SDL_Rect srcRect = {
-                spriteCol * (tileWidth + TILE_MARGIN) + TILE_MARGIN,
-                spriteRow * (tileHeight + TILE_MARGIN) + TILE_MARGIN,
-                tileWidth,
-                tileHeight
-            };
+            float u0 = src.x * texelU;
+            float v0 = src.y * texelV;
+            float u1 = (src.x + src.w) * texelU;
+            float v1 = (src.y + src.h) * texelV;
+            float x0 = (float)((x - range.x) * tileWidth);
+            float y0 = (float)((y - range.y) * tileHeight);
+            float x1 = x0 + tileWidth;
+            float y1 = y0 + tileHeight;
             
-            // Destination rectangle on screen (accounting for camera)
-            SDL_Rect dstRect = {
-                (int)(x * tileWidth - cameraX),
-                (int)(y * tileHeight - cameraY),
-                tileWidth,
-                tileHeight
+            // Corners clockwise from the top left, two triangles per quad
+            int first = (int)geometryVertices.size();
+            SDL_Vertex corners[4] = {
+                { { x0, y0 }, white, { u0, v0 } },
+                { { x1, y0 }, white, { u1, v0 } },
+                { { x1, y1 }, white, { u1, v1 } },
+                { { x0, y1 }, white, { u0, v1 } },
             };
+            for (int c = 0; c < 4; c++) {
+                geometryVertices.push_back(corners[c]);
+                geometryBase.push_back(corners[c].position);
+            }
+            int quad[6] = { first, first + 1, first + 2, first, first + 2, first + 3 };
+            geometryIndices.insert(geometryIndices.end(), quad, quad + 6);
+            if (paletteAnimation[cell] >= 0) {
+                AnimatedQuad animated = { first, cell };
+                geometryAnimated.push_back(animated);
+            }
+        }
+    }
+}
+
+SDL_Rect Tilemap::geometryRangeFor(float cameraX, float cameraY, int screenWidth, int screenHeight,
+                                   float zoom) const {
+    // renderGeometry floors the batch up to a pixel up and left of the
+    // camera, so reach a pixel past the far edges
+    int startX = std::max(0, (int)std::floor(cameraX / tileWidth));
+    int startY = std::max(0, (int)std::floor(cameraY / tileHeight));
+    int endX = std::min(mapWidth, (int)std::floor((cameraX + (screenWidth + 1) / zoom) / tileWidth) + 1);
+    int endY = std::min(mapHeight, (int)std::floor((cameraY + (screenHeight + 1) / zoom) / tileHeight) + 1);
+    SDL_Rect range = { startX, startY, std::max(0, endX - startX), std::max(0, endY - startY) };
+    return range;
+}
+
+bool Tilemap::renderGeometry(float cameraX, float cameraY, const SDL_Rect &range, float zoom) {
+    if (!geometryValid || range.x != geometryRange.x || range.y != geometryRange.y ||
+        range.w != geometryRange.w || range.h != geometryRange.h) {
+        buildGeometry(range);
+    }
+    
+    // Whole-pixel position of the range's top-left tile, floored like the
+    // per-tile path; moving within a tile only shifts the quads
+    float offsetX = std::floor((range.x * tileWidth - cameraX) * zoom);
+    float offsetY = std::floor((range.y * tileHeight - cameraY) * zoom);
+    if (offsetX != geometryOffsetX || offsetY != geometryOffsetY || zoom != geometryZoom) {
+        for (size_t i = 0; i < geometryVertices.size(); i++) {
+            geometryVertices[i].position.x = geometryBase[i].x * zoom + offsetX;
+            geometryVertices[i].position.y = geometryBase[i].y * zoom + offsetY;
+        }
+        geometryOffsetX = offsetX;
+        geometryOffsetY = offsetY;
+        geometryZoom = zoom;
+    }
+    
+    if (geometryIndices.empty()) return true;
+    return SDL_RenderGeometry(renderer, spritesheet,
+                              geometryVertices.data(), (int)geometryVertices.size(),
+                              geometryIndices.data(), (int)geometryIndices.size()) == 0;
+}
+#endif
+
+void Tilemap::setRenderCacheBudget(size_t bytes) {
+    renderCacheBudget = bytes;
+    dropRenderCache();
+}
+
+void Tilemap::invalidateRenderCache() {
+#ifdef HAVE_RENDER_GEOMETRY
+    geometryValid = false;
+#endif
+    for (size_t i = 0; i < renderChunks.size(); i++) {
+        renderChunks[i].dirty = true;
+    }
+}
+
+void Tilemap::dropRenderCache() {
+    for (size_t i = 0; i < renderChunks.size(); i++) {
+        SDL_DestroyTexture(renderChunks[i].texture);
+    }
+    renderChunks.clear();
+    std::fill(renderChunkSlot.begin(), renderChunkSlot.end(), -1);
+    for (size_t i = 0; i < layers.size(); i++) {
+        std::fill(layers[i].blockSlot.begin(), layers[i].blockSlot.end(), -1);
+    }
+}
+
+void Tilemap::resetBlocks() {
+    blocksAcross = (mapWidth + BLOCK_TILES - 1) / BLOCK_TILES;
+    blocksDown = (mapHeight + BLOCK_TILES - 1) / BLOCK_TILES;
+    size_t blocks = (size_t)blocksAcross * blocksDown;
+    changedBits.assign((blocks + 63) / 64, 0);
+    renderChunkSlot.assign(blocks, -1);
+    for (size_t i = 0; i < layers.size(); i++) {
+        if (layers[i].cells.getWidth() != mapWidth || layers[i].cells.getHeight() != mapHeight) {
+            layers[i].cells.resize(mapWidth, mapHeight, 0);
+        }
+        layers[i].blockSlot.assign(blocks, -1);
+    }
+    dropRenderCache();
+    markMapReplaced();
+}
+
+void Tilemap::markBlockChanged(int block) {
+    int slot = renderChunkSlot[block];
+    if (slot >= 0) renderChunks[slot].dirty = true;
+    
+    // Nothing to journal while a full rebuild is pending anyway
+    uint64_t bit = (uint64_t)1 << (block & 63);
+    if (!mapReplaced && !(changedBits[block >> 6] & bit)) {
+        changedBits[block >> 6] |= bit;
+        changedBlocks.push_back(block);
+    }
+}
+
+void Tilemap::markRowsChanged(int y0, int y1) {
+    y0 = std::max(0, y0);
+    y1 = std::min(mapHeight - 1, y1);
+    if (y0 > y1) return;
+#ifdef HAVE_RENDER_GEOMETRY
+    if (y0 < geometryRange.y + geometryRange.h && y1 >= geometryRange.y) {
+        geometryValid = false;
+    }
+#endif
+    for (int by = y0 / BLOCK_TILES; by <= y1 / BLOCK_TILES; by++) {
+        for (int bx = 0; bx < blocksAcross; bx++) {
+            markBlockChanged(by * blocksAcross + bx);
+        }
+    }
+}
+
+void Tilemap::markMapReplaced() {
+    for (size_t i = 0; i < changedBlocks.size(); i++) {
+        changedBits[changedBlocks[i] >> 6] &= ~((uint64_t)1 << (changedBlocks[i] & 63));
+    }
+    changedBlocks.clear();
+    mapReplaced = true;
+    minimapStale = true;
+    animationIndexStale = true;
+    invalidateRenderCache();
+}
+
+bool Tilemap::drainChangedBlocks(std::vector<int> &blocks) {
+    blocks.clear();
+    if (mapReplaced) {
+        mapReplaced = false;
+        return true;
+    }
+    for (size_t i = 0; i < changedBlocks.size(); i++) {
+        changedBits[changedBlocks[i] >> 6] &= ~((uint64_t)1 << (changedBlocks[i] & 63));
+    }
+    blocks.swap(changedBlocks);
+    return false;
+}
+
+SDL_Rect Tilemap::getBlockRect(int block) const {
+    int x = (block % blocksAcross) * BLOCK_TILES;
+    int y = (block / blocksAcross) * BLOCK_TILES;
+    SDL_Rect rect = { x, y, std::min(BLOCK_TILES, mapWidth - x), std::min(BLOCK_TILES, mapHeight - y) };
+    return rect;
+}
+
+void Tilemap::computeTileColours(SDL_Surface *surface) {
+    tileColours.assign(atlas.getTileCount(), 0);
+    SDL_Surface *argb = SDL_ConvertSurfaceFormat(surface, SDL_PIXELFORMAT_ARGB8888, 0);
+    if (!argb) {
+        std::cerr << "SDL_ConvertSurfaceFormat failed: " << SDL_GetError() << std::endl;
+        return;
+    }
+    SDL_LockSurface(argb);
+    for (int id = 0; id < atlas.getTileCount(); id++) {
+        SDL_Rect rect = atlas.rect((TileId)id);
+        rect.w = std::min(rect.w, argb->w - rect.x);
+        rect.h = std::min(rect.h, argb->h - rect.y);
+        if (rect.w <= 0 || rect.h <= 0) continue;
+        // Premultiplied, so transparent pixels add nothing but coverage
+        uint64_t a = 0, r = 0, g = 0, b = 0;
+        for (int y = rect.y; y < rect.y + rect.h; y++) {
+            const uint32_t *row = (const uint32_t*)((const uint8_t*)argb->pixels + (size_t)y * argb->pitch);
+            for (int x = rect.x; x < rect.x + rect.w; x++) {
+                uint32_t alpha = row[x] >> 24;
+                a += alpha;
+                r += ((row[x] >> 16) & 0xFF) * alpha / 255;
+                g += ((row[x] >> 8) & 0xFF) * alpha / 255;
+                b += (row[x] & 0xFF) * alpha / 255;
+            }
+        }
+        uint64_t n = (uint64_t)rect.w * rect.h;
+        tileColours[id] = (uint32_t)(a / n) << 24 | (uint32_t)(r / n) << 16 |
+                          (uint32_t)(g / n) << 8 | (uint32_t)(b / n);
+    }
+    SDL_UnlockSurface(argb);
+    SDL_FreeSurface(argb);
+}
+
+void Tilemap::enableMinimap(int levels) {
+    minimapLevelCount = std::max(1, std::min(levels, 6));  // a block is 1 pixel at level 5
+    minimapStale = true;
+    minimapFailed = false;
+}
+
+int Tilemap::getMinimapLevelCount() {
+    if (minimapStale) {
+        updateMinimap();
+    }
+    return minimapTexture ? (int)minimapLevels.size() : 0;
+}
+
+void Tilemap::markMinimapChanged(int x, int row) {
+    // Nothing to queue while the whole pyramid is redrawn anyway
+    if (minimapStale) return;
+    int block = (row / BLOCK_TILES) * blocksAcross + x / BLOCK_TILES;
+    uint64_t bit = (uint64_t)1 << (block & 63);
+    if (!(minimapDirtyBits[block >> 6] & bit)) {
+        minimapDirtyBits[block >> 6] |= bit;
+        minimapDirty.push_back(block);
+    }
+}
+
+void Tilemap::markMinimapRows(int row0, int row1) {
+    for (int row = row0; row < row1; row += BLOCK_TILES - row % BLOCK_TILES) {
+        for (int x = 0; x < mapWidth; x += BLOCK_TILES) {
+            markMinimapChanged(x, row);
+        }
+    }
+}
+
+// Premultiplied average of up to four pixels
+static uint32_t averagePixels(const uint32_t *pixels, int count) {
+    uint32_t a = 0, r = 0, g = 0, b = 0;
+    for (int i = 0; i < count; i++) {
+        a += pixels[i] >> 24;
+        r += (pixels[i] >> 16) & 0xFF;
+        g += (pixels[i] >> 8) & 0xFF;
+        b += pixels[i] & 0xFF;
+    }
+    return (a / count) << 24 | (r / count) << 16 | (g / count) << 8 | (b / count);
+}
+
+void Tilemap::drawMinimapBlock(int block) {
+    int x0 = (block % blocksAcross) * BLOCK_TILES;
+    int y0 = (block / blocksAcross) * BLOCK_TILES;
+    int x1 = std::min(mapWidth, x0 + BLOCK_TILES);
+    int y1 = std::min(tiles.getHeight(), y0 + BLOCK_TILES);
+    
+    // Level 0: a block row never crosses a storage chunk
+    for (int row = y0; row < y1; row++) {
+        uint32_t *out = &minimapPixels[(size_t)row * minimapPitch];
+        int y = mapRow(row);
+        uint8_t value;
+        if (y < 0 || y >= mapHeight) {
+            std::fill(out + x0, out + x1, 0);
+        } else if (tiles.isUniform(x0, row, value)) {
+            std::fill(out + x0, out + x1, paletteColours[value]);
+        } else {
+            const uint8_t *cells = tiles.span(x0, row);
+            for (int x = x0; x < x1; x++) {
+                out[x] = paletteColours[cells[x - x0]];
+            }
+        }
+    }
+    
+    // Each level from the one before; blocks stay aligned down to level 5
+    for (size_t level = 1; level < minimapLevels.size(); level++) {
+        const SDL_Rect &from = minimapLevels[level - 1];
+        const SDL_Rect &to = minimapLevels[level];
+        int shift = (int)level;
+        for (int j = y0 >> shift; j < std::min(to.h, ((y1 - 1) >> shift) + 1); j++) {
+            for (int i = x0 >> shift; i < std::min(to.w, ((x1 - 1) >> shift) + 1); i++) {
+                uint32_t children[4];
+                int count = 0;
+                for (int cy = 2 * j; cy < std::min(from.h, 2 * j + 2); cy++) {
+                    for (int cx = 2 * i; cx < std::min(from.w, 2 * i + 2); cx++) {
+                        children[count++] = minimapPixels[(size_t)(from.y + cy) * minimapPitch + from.x + cx];
+                    }
+                }
+                minimapPixels[(size_t)(to.y + j) * minimapPitch + to.x + i] = averagePixels(children, count);
+            }
+        }
+    }
+}
+
+void Tilemap::uploadMinimapBlock(int block) {
+    int x0 = (block % blocksAcross) * BLOCK_TILES;
+    int y0 = (block / blocksAcross) * BLOCK_TILES;
+    int x1 = std::min(mapWidth, x0 + BLOCK_TILES);
+    int y1 = std::min(tiles.getHeight(), y0 + BLOCK_TILES);
+    for (size_t level = 0; level < minimapLevels.size(); level++) {
+        const SDL_Rect &area = minimapLevels[level];
+        int shift = (int)level;
+        SDL_Rect rect = { area.x + (x0 >> shift), area.y + (y0 >> shift),
+                          ((x1 - 1) >> shift) - (x0 >> shift) + 1, ((y1 - 1) >> shift) - (y0 >> shift) + 1 };
+        SDL_UpdateTexture(minimapTexture, &rect,
+                          &minimapPixels[(size_t)rect.y * minimapPitch + rect.x],
+                          minimapPitch * (int)sizeof(uint32_t));
+    }
+}
+
+bool Tilemap::updateMinimap() {
+    if (minimapLevelCount == 0 || !renderer || tiles.empty()) return false;
+    if (!minimapStale) {
+        for (size_t i = 0; i < minimapDirty.size(); i++) {
+            int block = minimapDirty[i];
+            minimapDirtyBits[block >> 6] &= ~((uint64_t)1 << (block & 63));
+            drawMinimapBlock(block);
+            uploadMinimapBlock(block);
+        }
+        minimapDirty.clear();
+        return minimapTexture != nullptr;
+    }
+    
+    // Lay the levels out in storage rows. Streamed chunk rows must start on
+    // a pixel of every level, or a pixel would mix two unrelated rows.
+    int levels = minimapLevelCount;
+    while (levels > 1 && isStreaming() && chunkSize % (1 << (levels - 1)) != 0) {
+        levels--;
+    }
+    int width = mapWidth;
+    int height = tiles.getHeight();
+    minimapLevels.assign(1, SDL_Rect{ 0, 0, width, height });
+    int stackY = 0;
+    for (int level = 1; level < levels; level++) {
+        SDL_Rect area = { width, stackY, (width + (1 << level) - 1) >> level,
+                          (height + (1 << level) - 1) >> level };
+        minimapLevels.push_back(area);
+        stackY += area.h;
+    }
+    int textureWidth = width + (levels > 1 ? minimapLevels[1].w : 0);
+    
+    int oldWidth = 0, oldHeight = 0;
+    if (minimapTexture) {
+        SDL_QueryTexture(minimapTexture, nullptr, nullptr, &oldWidth, &oldHeight);
+    }
+    if (oldWidth != textureWidth || oldHeight != height) {
+        if (minimapTexture) {
+            SDL_DestroyTexture(minimapTexture);
+            minimapTexture = nullptr;
+        }
+        SDL_RendererInfo info;
+        if (SDL_GetRendererInfo(renderer, &info) == 0 && info.max_texture_width > 0 &&
+            (textureWidth > info.max_texture_width || height > info.max_texture_height)) {
+            std::cerr << "Minimap of " << textureWidth << "x" << height << " exceeds the renderer's "
+                      << info.max_texture_width << "x" << info.max_texture_height
+                      << " texture limit" << std::endl;
+            minimapLevelCount = 0;
+            minimapLevels.clear();
+            minimapFailed = true;
+            return false;
+        }
+        minimapTexture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888,
+                                           SDL_TEXTUREACCESS_STREAMING, textureWidth, height);
+        if (!minimapTexture) {
+            std::cerr << "Failed to create minimap texture: " << SDL_GetError() << std::endl;
+            minimapLevelCount = 0;
+            minimapLevels.clear();
+            minimapFailed = true;
+            return false;
+        }
+        SDL_SetTextureBlendMode(minimapTexture, renderChunkBlend);
+    }
+    minimapPitch = textureWidth;
+    minimapPixels.assign((size_t)textureWidth * height, 0);
+    
+    // Block rows own their pixels in every level, so they fill in parallel
+    int blocks = blocksAcross * ((height + BLOCK_TILES - 1) / BLOCK_TILES);
+    minimapDirtyBits.assign((blocks + 63) / 64, 0);
+    minimapDirty.clear();
+    ThreadPool::getInstance()->parallelFor(0, blocks / blocksAcross, [this](int by0, int by1) {
+        for (int block = by0 * blocksAcross; block < by1 * blocksAcross; block++) {
+            drawMinimapBlock(block);
+        }
+    });
+    SDL_UpdateTexture(minimapTexture, nullptr, minimapPixels.data(), minimapPitch * (int)sizeof(uint32_t));
+    minimapStale = false;
+    return true;
+}
+
+bool Tilemap::renderMinimap(int level, const SDL_Rect *area, const SDL_Rect &dst) {
+    if (!updateMinimap() || level < 0 || level >= (int)minimapLevels.size()) return false;
+    SDL_Rect view = area ? *area : SDL_Rect{ 0, 0, mapWidth, mapHeight };
+    int x0 = std::max(0, view.x);
+    int x1 = std::min(mapWidth, view.x + view.w);
+    int y0 = std::max(0, view.y);
+    int y1 = std::min(mapHeight, view.y + view.h);
+    if (x0 >= x1 || y0 >= y1) return true;
+    
+    // dst covers view; the clipped part lands proportionally inside it
+    const SDL_Rect &source = minimapLevels[level];
+    int shift = level;
+    int dstX0 = dst.x + (int)((int64_t)(x0 - view.x) * dst.w / view.w);
+    int dstX1 = dst.x + (int)((int64_t)(x1 - view.x) * dst.w / view.w);
+    
+    // One copy per run of map rows that are consecutive in storage
+    int y = y0;
+    while (y < y1) {
+        int row = storageRow(y);
+        int end;
+        if (!isStreaming()) {
+            end = y1;
+        } else {
+            end = std::min(y1, (y / chunkSize + 1) * chunkSize);
+            while (row >= 0 && end < y1 && storageRow(end) == row + (end - y)) {
+                end = std::min(y1, end + chunkSize);
+            }
+        }
+        if (row >= 0) {
+            int rowEnd = row + (end - y);
+            SDL_Rect src = { source.x + (x0 >> shift), source.y + (row >> shift),
+                             ((x1 - 1) >> shift) - (x0 >> shift) + 1,
+                             ((rowEnd - 1) >> shift) - (row >> shift) + 1 };
+            int dstY0 = dst.y + (int)((int64_t)(y - view.y) * dst.h / view.h);
+            int dstY1 = dst.y + (int)((int64_t)(end - view.y) * dst.h / view.h);
+            SDL_Rect out = { dstX0, dstY0, dstX1 - dstX0, dstY1 - dstY0 };
+            SDL_RenderCopy(renderer, minimapTexture, &src, &out);
+        }
+        y = end;
+    }
+    return true;
+}
+
+bool Tilemap::addAnimation(int tileId, const std::vector<int> &frames, const std::vector<Uint32> &durations) {
+    if (tileId < 0 || tileId >= NO_TILE || frames.empty() || frames.size() != durations.size()) {
+        std::cerr << "Animation of tile " << tileId << " needs frames with a duration each" << std::endl;
+        return false;
+    }
+    TileAnimation animation;
+    animation.tile = (TileId)tileId;
+    animation.period = 0;
+    animation.current = 0;
+    animation.changed = false;
+    for (size_t i = 0; i < frames.size(); i++) {
+        if (frames[i] < 0 || frames[i] >= NO_TILE || durations[i] == 0) {
+            std::cerr << "Bad frame " << frames[i] << " (" << durations[i] << " ms) in animation of tile "
+                      << tileId << std::endl;
+            return false;
+        }
+        animation.frames.push_back((TileId)frames[i]);
+        animation.durations.push_back(durations[i]);
+        animation.period += durations[i];
+    }
+    
+    size_t slot = 0;
+    while (slot < animations.size() && animations[slot].tile != animation.tile) slot++;
+    if (slot == animations.size()) {
+        animations.push_back(animation);
+    } else {
+        animations[slot] = animation;
+    }
+    refreshAnimatedPalette();
+    return true;
+}
+
+void Tilemap::clearAnimations() {
+    animations.clear();
+    refreshAnimatedPalette();
+    rebuildAnimationIndex();
+}
+
+void Tilemap::refreshAnimatedPalette() {
+    for (size_t i = 0; i < palette.size(); i++) {
+        updatePaletteEntry((int)i);
+    }
+    // Cells that start or stop animating show a different tile now
+    invalidateRenderCache();
+    animationIndexStale = true;
+}
+
+void Tilemap::indexAnimatedCell(int x, int y, bool animated) {
+    if (animationIndexStale) return;
+    int block = (y / BLOCK_TILES) * blocksAcross + x / BLOCK_TILES;
+    uint16_t offset = (uint16_t)((y % BLOCK_TILES) * BLOCK_TILES + x % BLOCK_TILES);
+    std::vector<uint16_t> &cells = animatedCells[block];
+    if (animated) {
+        cells.push_back(offset);
+        animatedCellCount++;
+        if (!animatedListed[block]) {
+            animatedListed[block] = true;
+            animatedBlocks.push_back(block);
+        }
+        return;
+    }
+    std::vector<uint16_t>::iterator found = std::find(cells.begin(), cells.end(), offset);
+    if (found != cells.end()) {
+        *found = cells.back();
+        cells.pop_back();
+        animatedCellCount--;
+    }
+}
+
+void Tilemap::indexAnimatedRows(int y0, int y1) {
+    y0 = std::max(0, y0);
+    y1 = std::min(mapHeight, y1);
+    if (animationIndexStale || animations.empty() || y0 >= y1) return;
+    
+    // Drop what the blocks listed for these rows, then list them afresh
+    for (int by = y0 / BLOCK_TILES; by <= (y1 - 1) / BLOCK_TILES; by++) {
+        int first = std::max(0, y0 - by * BLOCK_TILES) * BLOCK_TILES;
+        int last = std::min(BLOCK_TILES, y1 - by * BLOCK_TILES) * BLOCK_TILES;
+        for (int bx = 0; bx < blocksAcross; bx++) {
+            std::vector<uint16_t> &cells = animatedCells[by * blocksAcross + bx];
+            size_t kept = 0;
+            for (size_t i = 0; i < cells.size(); i++) {
+                if (cells[i] < first || cells[i] >= last) cells[kept++] = cells[i];
+            }
+            animatedCellCount -= (int)(cells.size() - kept);
+            cells.resize(kept);
+        }
+    }
+    for (int y = y0; y < y1; y++) {
+        int row = storageRow(y);
+        if (row < 0) continue;
+        for (int x = 0; x < mapWidth; x += SparseTileGrid::spanLength(x)) {
+            int count = std::min(SparseTileGrid::spanLength(x), mapWidth - x);
+            uint8_t value;
+            if (tiles.isUniform(x, row, value) && paletteAnimation[value] < 0) continue;
+            const uint8_t *span = tiles.span(x, row);
+            for (int i = 0; i < count; i++) {
+                if (paletteAnimation[span[i]] >= 0) indexAnimatedCell(x + i, y, true);
+            }
+        }
+    }
+}
+
+void Tilemap::rebuildAnimationIndex() {
+    size_t blocks = (size_t)blocksAcross * blocksDown;
+    animatedCells.assign(animations.empty() ? 0 : blocks, std::vector<uint16_t>());
+    animatedListed.assign(animatedCells.size(), false);
+    animatedBlocks.clear();
+    animatedCellCount = 0;
+    animationIndexStale = false;
+    
+    // Only storage rows are scanned; a streamed map is mostly not resident
+    for (int row = 0; row < tiles.getHeight() && !animations.empty(); row++) {
+        int y = mapRow(row);
+        if (y >= 0) indexAnimatedRows(y, y + 1);
+    }
+}
+
+void Tilemap::updateAnimations(Uint32 ticks) {
+    if (animations.empty()) return;
+    if (animationIndexStale) {
+        rebuildAnimationIndex();
+    }
+    
+    bool changed = false;
+    for (size_t i = 0; i < animations.size(); i++) {
+        TileAnimation &animation = animations[i];
+        Uint32 t = ticks % animation.period;
+        int frame = 0;
+        while (t >= animation.durations[frame]) {
+            t -= animation.durations[frame];
+            frame++;
+        }
+        animation.changed = frame != animation.current;
+        animation.current = frame;
+        changed = changed || animation.changed;
+    }
+    if (!changed) return;
+    
+    // Tile-by-tile drawing and future bakes read the palette's rects
+    SDL_Rect none = { 0, 0, 0, 0 };
+    for (size_t i = 0; i < palette.size(); i++) {
+        int a = paletteAnimation[i];
+        if (a < 0 || !animations[a].changed) continue;
+        TileId shown = animations[a].frames[animations[a].current];
+        paletteRects[i] = atlas.contains(shown) ? atlas.rect(shown) : none;
+    }
+    
+    // Blocks already baked get just their animated cells redrawn
+    for (size_t i = 0; i < animatedBlocks.size(); ) {
+        int block = animatedBlocks[i];
+        if (animatedCells[block].empty()) {
+            animatedListed[block] = false;
+            animatedBlocks[i] = animatedBlocks.back();
+            animatedBlocks.pop_back();
+            continue;
+        }
+        int slot = renderChunkSlot[block];
+        if (slot >= 0 && !renderChunks[slot].dirty) {
+            patchAnimatedBlock(renderChunks[slot], animatedCells[block]);
+        }
+        i++;
+    }
+    
+#ifdef HAVE_RENDER_GEOMETRY
+    // The batch's animated quads get new texture coordinates
+    if (geometryValid && sheetWidth > 0 && sheetHeight > 0) {
+        float texelU = 1.0f / sheetWidth;
+        float texelV = 1.0f / sheetHeight;
+        for (size_t i = 0; i < geometryAnimated.size(); i++) {
+            int a = paletteAnimation[geometryAnimated[i].cell];
+            if (a < 0 || !animations[a].changed) continue;
+            const SDL_Rect &src = paletteRects[geometryAnimated[i].cell];
+            SDL_Vertex *quad = &geometryVertices[geometryAnimated[i].vertex];
+            float u0 = src.x * texelU;
+            float v0 = src.y * texelV;
+            float u1 = (src.x + src.w) * texelU;
+            float v1 = (src.y + src.h) * texelV;
+            quad[0].tex_coord = SDL_FPoint{ u0, v0 };
+            quad[1].tex_coord = SDL_FPoint{ u1, v0 };
+            quad[2].tex_coord = SDL_FPoint{ u1, v1 };
+            quad[3].tex_coord = SDL_FPoint{ u0, v1 };
+        }
+    }
+#endif
+}
+
+void Tilemap::patchAnimatedBlock(RenderChunk &entry, const std::vector<uint16_t> &cells) {
+    SDL_Texture *previousTarget = nullptr;
+    Uint8 r, g, b, a;
+    SDL_BlendMode blend;
+    bool targeted = false;
+    
+    int x0 = (entry.chunk % blocksAcross) * BLOCK_TILES;
+    int y0 = (entry.chunk / blocksAcross) * BLOCK_TILES;
+    for (size_t i = 0; i < cells.size(); i++) {
+        int x = cells[i] % BLOCK_TILES;
+        int y = cells[i] / BLOCK_TILES;
+        int row = storageRow(y0 + y);
+        if (row < 0) continue;
+        uint8_t cell = tiles.get(x0 + x, row);
+        int animation = paletteAnimation[cell];
+        if (animation < 0 || !animations[animation].changed) continue;
+        
+        if (!targeted) {
+            previousTarget = SDL_GetRenderTarget(renderer);
+            SDL_GetRenderDrawColor(renderer, &r, &g, &b, &a);
+            SDL_GetRenderDrawBlendMode(renderer, &blend);
+            SDL_SetRenderTarget(renderer, entry.texture);
+            SDL_SetRenderDrawColor(renderer, 0, 0, 0, 0);
+            SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_NONE);
+            targeted = true;
+        }
+        // Back to transparent, as the bake started, then the new frame
+        SDL_Rect dstRect = { x * tileWidth, y * tileHeight, tileWidth, tileHeight };
+        SDL_RenderFillRect(renderer, &dstRect);
+        drawCell(paletteRects, cell, dstRect.x, dstRect.y, tileWidth, tileHeight);
+    }
+    
+    if (targeted) {
+        SDL_SetRenderTarget(renderer, previousTarget);
+        SDL_SetRenderDrawColor(renderer, r, g, b, a);
+        SDL_SetRenderDrawBlendMode(renderer, blend);
+    }
+}
+
+Tilemap::RenderChunk* Tilemap::acquireRenderChunk(int layer, int chunk) {
+    int slot = blockSlots(layer)[chunk];
+    if (slot < 0) {
+        // Reuse the least recently drawn texture once the budget is spent,
+        // but never one already drawn this frame, and static layers' last
+        size_t blockBytes = (size_t)BLOCK_TILES * tileWidth * BLOCK_TILES * tileHeight * 4;
+        if ((renderChunks.size() + 1) * blockBytes > renderCacheBudget) {
+            bool slotStatic = false;
+            for (size_t i = 0; i < renderChunks.size(); i++) {
+                if (renderChunks[i].lastUsed == renderFrame) continue;
+                const TileLayer *owner = findLayer(renderChunks[i].layer);
+                bool isStatic = owner && owner->isStatic;
+                if (slot < 0 || (slotStatic && !isStatic) ||
+                    (slotStatic == isStatic && renderChunks[i].lastUsed < renderChunks[slot].lastUsed)) {
+                    slot = (int)i;
+                    slotStatic = isStatic;
+                }
+            }
+        }
+        
+        if (slot >= 0) {
+            blockSlots(renderChunks[slot].layer)[renderChunks[slot].chunk] = -1;
+        } else {
+            SDL_Texture *texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888,
+                                                     SDL_TEXTUREACCESS_TARGET,
+                                                     BLOCK_TILES * tileWidth,
+                                                     BLOCK_TILES * tileHeight);
+            if (!texture) {
+                // Same fallback as a renderer without targets; this frame
+                // finishes tile by tile
+#ifdef HAVE_RENDER_GEOMETRY
+                std::cerr << "SDL_CreateTexture failed, drawing a geometry batch: "
+                          << SDL_GetError() << std::endl;
+                renderMode = RENDER_GEOMETRY;
+#else
+                std::cerr << "SDL_CreateTexture failed, drawing tiles directly: "
+                          << SDL_GetError() << std::endl;
+                renderMode = RENDER_TILES;
+#endif
+                return nullptr;
+            }
+            if (SDL_SetTextureBlendMode(texture, renderChunkBlend) != 0) {
+                // No custom blend modes on this renderer; close enough for
+                // tiles whose alpha is all or nothing
+                renderChunkBlend = SDL_BLENDMODE_BLEND;
+                SDL_SetTextureBlendMode(texture, renderChunkBlend);
+            }
+            RenderChunk entry = { texture, 0, -1, 0, true };
+            renderChunks.push_back(entry);
+            slot = (int)renderChunks.size() - 1;
+        }
+        renderChunks[slot].layer = layer;
+        renderChunks[slot].chunk = chunk;
+        renderChunks[slot].dirty = true;
+        blockSlots(layer)[chunk] = slot;
+    }
+    renderChunks[slot].lastUsed = renderFrame;
+    return &renderChunks[slot];
+}
+
+void Tilemap::bakeRenderChunk(RenderChunk &entry) {
+    SDL_Texture *previousTarget = SDL_GetRenderTarget(renderer);
+    Uint8 r, g, b, a;
+    SDL_GetRenderDrawColor(renderer, &r, &g, &b, &a);
+    
+    SDL_SetRenderTarget(renderer, entry.texture);
+    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 0);
+    SDL_RenderClear(renderer);
+    
+    int x0 = (entry.chunk % blocksAcross) * BLOCK_TILES;
+    int y0 = (entry.chunk / blocksAcross) * BLOCK_TILES;
+    int x1 = std::min(mapWidth, x0 + BLOCK_TILES);
+    int y1 = std::min(mapHeight, y0 + BLOCK_TILES);
+    const SparseTileGrid &cells = layerCells(entry.layer);
+    const SDL_Rect *rects = layerRects(entry.layer);
+    for (int y = y0; y < y1; y++) {
+        int row = layerRow(entry.layer, y);
+        if (row < 0) continue;
+        for (int x = x0; x < x1; x++) {
+            drawCell(rects, cells.get(x, row), (x - x0) * tileWidth, (y - y0) * tileHeight, tileWidth, tileHeight);
+        }
+    }
+    
+    SDL_SetRenderTarget(renderer, previousTarget);
+    SDL_SetRenderDrawColor(renderer, r, g, b, a);
+    entry.dirty = false;
+}
+
+const SparseTileGrid& Tilemap::layerCells(int layer) const {
+    return layer > 0 ? layers[layer - 1].cells : tiles;
+}
+
+int Tilemap::layerRow(int layer, int y) const {
+    return layer > 0 ? y : storageRow(y);
+}
+
+const std::vector<TileId>& Tilemap::layerPalette(int layer) const {
+    return layer > 0 ? layers[layer - 1].palette : palette;
+}
+
+const SDL_Rect* Tilemap::layerRects(int layer) const {
+    return layer > 0 ? layers[layer - 1].rects : paletteRects;
+}
+
+std::vector<int>& Tilemap::blockSlots(int layer) {
+    return layer > 0 ? layers[layer - 1].blockSlot : renderChunkSlot;
+}
+
+Tilemap::TileLayer* Tilemap::findLayer(int layer) {
+    return layer >= 1 && layer <= (int)layers.size() ? &layers[layer - 1] : nullptr;
+}
+
+const Tilemap::TileLayer* Tilemap::findLayer(int layer) const {
+    return layer >= 1 && layer <= (int)layers.size() ? &layers[layer - 1] : nullptr;
+}
+
+bool Tilemap::isBlockEmpty(int layer, int block) const {
+    static_assert(SparseTileGrid::CHUNK_SIZE % BLOCK_TILES == 0, "blocks must not straddle storage chunks");
+    SDL_Rect rect = getBlockRect(block);
+    // A streamed block can straddle two ring slots; those are never skipped
+    int row0 = layerRow(layer, rect.y);
+    int row1 = layerRow(layer, rect.y + rect.h - 1);
+    if (row0 < 0 || row1 - row0 != rect.h - 1 ||
+        (row0 >> SparseTileGrid::CHUNK_SHIFT) != (row1 >> SparseTileGrid::CHUNK_SHIFT)) {
+        return false;
+    }
+    uint8_t value;
+    return layerCells(layer).isUniform(rect.x, row0, value) && layerPalette(layer)[value] == NO_TILE;
+}
+
+void Tilemap::updateLayerRect(TileLayer &layer, int index) {
+    SDL_Rect none = { 0, 0, 0, 0 };
+    layer.rects[index] = atlas.contains(layer.palette[index]) ? atlas.rect(layer.palette[index]) : none;
+}
+
+int Tilemap::addLayer(int depth, float parallax, Uint8 opacity) {
+    TileLayer layer;
+    layer.cells.resize(mapWidth, mapHeight, 0);
+    layer.palette.assign(1, NO_TILE);
+    updateLayerRect(layer, 0);
+    layer.depth = depth;
+    layer.parallax = parallax;
+    layer.opacity = opacity;
+    layer.visible = true;
+    layer.isStatic = false;
+    layer.blockSlot.assign((size_t)blocksAcross * blocksDown, -1);
+    layers.push_back(std::move(layer));
+    int id = (int)layers.size();
+    
+    // Equal depths draw in the order they were added
+    std::vector<int>::iterator pos = layerOrder.begin();
+    while (pos != layerOrder.end() && layers[*pos - 1].depth <= depth) ++pos;
+    layerOrder.insert(pos, id);
+    return id;
+}
+
+bool Tilemap::loadLayer(int layer, SparseTileGrid &&cells, const std::vector<int> &cellPalette) {
+    TileLayer *target = findLayer(layer);
+    if (!target) {
+        std::cerr << "No tile layer " << layer << std::endl;
+        return false;
+    }
+    if (cells.getWidth() != mapWidth || cells.getHeight() != mapHeight) {
+        std::cerr << "Layer size " << cells.getWidth() << "x" << cells.getHeight()
+                  << " does not match tilemap " << mapWidth << "x" << mapHeight << std::endl;
+        return false;
+    }
+    if (cellPalette.empty() || (int)cellPalette.size() > MAX_PALETTE_SIZE) {
+        std::cerr << "Invalid palette size: " << cellPalette.size() << std::endl;
+        return false;
+    }
+    
+    target->cells = std::move(cells);
+    target->palette.resize(cellPalette.size());
+    for (size_t i = 0; i < cellPalette.size(); i++) {
+        int tileIndex = cellPalette[i];
+        target->palette[i] = (tileIndex < 0 || tileIndex >= NO_TILE) ? NO_TILE : (TileId)tileIndex;
+        updateLayerRect(*target, (int)i);
+    }
+    for (size_t i = 0; i < target->blockSlot.size(); i++) {
+        if (target->blockSlot[i] >= 0) renderChunks[target->blockSlot[i]].dirty = true;
+    }
+    return true;
+}
+
+void Tilemap::setLayerTile(int layer, int x, int y, int tileIndex) {
+    if (layer == 0) {
+        setTile(x, y, tileIndex);
+        return;
+    }
+    TileLayer *target = findLayer(layer);
+    if (!target || !target->cells.inBounds(x, y)) return;
+    
+    TileId id = (tileIndex < 0 || tileIndex >= NO_TILE) ? NO_TILE : (TileId)tileIndex;
+    int index = (int)(std::find(target->palette.begin(), target->palette.end(), id) - target->palette.begin());
+    if (index == (int)target->palette.size()) {
+        if (index >= MAX_PALETTE_SIZE) {
+            std::cerr << "Layer palette full, cannot add tile " << tileIndex << std::endl;
+            return;
+        }
+        target->palette.push_back(id);
+        updateLayerRect(*target, index);
+    }
+    if (target->cells.get(x, y) == index) return;
+    target->cells.set(x, y, (uint8_t)index);
+    int slot = target->blockSlot[(y / BLOCK_TILES) * blocksAcross + x / BLOCK_TILES];
+    if (slot >= 0) renderChunks[slot].dirty = true;
+}
+
+int Tilemap::getLayerTile(int layer, int x, int y) const {
+    if (layer == 0) return getTile(x, y);
+    const TileLayer *source = findLayer(layer);
+    if (!source || !source->cells.inBounds(x, y)) return -1;
+    TileId id = source->palette[source->cells.get(x, y)];
+    return id == NO_TILE ? -1 : id;
+}
+
+void Tilemap::setLayerParallax(int layer, float parallax) {
+    TileLayer *target = findLayer(layer);
+    if (target) target->parallax = parallax;
+}
+
+void Tilemap::setLayerOpacity(int layer, Uint8 opacity) {
+    TileLayer *target = findLayer(layer);
+    if (target) target->opacity = opacity;
+}
+
+void Tilemap::setLayerVisible(int layer, bool visible) {
+    TileLayer *target = findLayer(layer);
+    if (target) target->visible = visible;
+}
+
+void Tilemap::setLayerStatic(int layer, bool isStatic) {
+    TileLayer *target = findLayer(layer);
+    if (target) target->isStatic = isStatic;
+}
+
+bool Tilemap::setAutotiler(const Autotiler &rules, int wallTile) {
+    autotiler = rules;
+    autotileWall = rules.empty() ? -1 : wallTile;
+    if (!refreshAutotilePalette()) {
+        return false;
+    }
+    retileAll();
+    return true;
+}
+
+bool Tilemap::refreshAutotilePalette() {
+    variantCells.assign(autotiler.getVariantCount(), 0);
+    for (int v = 0; autotileWall >= 0 && v < autotiler.getVariantCount(); v++) {
+        int index = paletteIndex(autotiler.getVariantTile(v));
+        if (index < 0) {
+            std::cerr << "No palette room for autotile variants, autotiling off" << std::endl;
+            autotileWall = -1;
+        } else {
+            variantCells[v] = (uint8_t)index;
+        }
+    }
+    // The wall flags of existing entries depend on the rules too
+    for (size_t i = 0; i < palette.size(); i++) {
+        updatePaletteEntry((int)i);
+    }
+    return autotileWall >= 0 || autotiler.empty();
+}
+
+uint8_t Tilemap::wallMask(int x, int y) const {
+    // Neighbours in Autotiler bit order, clockwise from north
+    static const int OFFSETS[8][2] = {
+        { 0, -1 }, { 1, -1 }, { 1, 0 }, { 1, 1 }, { 0, 1 }, { -1, 1 }, { -1, 0 }, { -1, -1 }
+    };
+    uint8_t mask = 0;
+    for (int i = 0; i < 8; i++) {
+        int nx = x + OFFSETS[i][0];
+        int ny = y + OFFSETS[i][1];
+        bool wall = true;
+        if (nx >= 0 && nx < mapWidth && ny >= 0 && ny < mapHeight) {
+            int row = storageRow(ny);
+            wall = row < 0 || paletteWall[tiles.get(nx, row)];
+        }
+        if (wall) mask |= (uint8_t)(1 << i);
+    }
+    return mask;
+}
+
+void Tilemap::retile(int x0, int y0, int x1, int y1) {
+    x0 = std::max(0, x0);
+    y0 = std::max(0, y0);
+    x1 = std::min(mapWidth - 1, x1);
+    y1 = std::min(mapHeight - 1, y1);
+    for (int y = y0; y <= y1; y++) {
+        int row = storageRow(y);
+        if (row < 0) continue;
+        for (int x = x0; x <= x1; x++) {
+            uint8_t cell = tiles.get(x, row);
+            if (!paletteWall[cell]) continue;
+            uint8_t variant = variantCells[autotiler.variantFor(wallMask(x, y))];
+            if (variant != cell) {
+                writeCell(x, y, row, variant);
+            }
+        }
+    }
+}
+
+void Tilemap::retileAll() {
+    if (autotileWall < 0 || tiles.empty()) return;
+    ThreadPool *pool = ThreadPool::getInstance();
+    int rows = tiles.getHeight();
+    // A storage chunk row is exactly one wall word
+    static_assert(SparseTileGrid::CHUNK_SIZE == 64, "wall words must match storage chunks");
+    
+    // Wall flags first, so no band reads cells another band is rewriting.
+    // Bits past the right edge are set: outside the map counts as wall.
+    BitGrid walls(mapWidth, rows);
+    int words = walls.getWordsPerRow();
+    pool->parallelFor(0, rows, [this, &walls, words](int r0, int r1) {
+        for (int r = r0; r < r1; r++) {
+            uint64_t *out = walls.row(r);
+            for (int j = 0; j < words; j++) {
+                int x = j * 64;
+                int n = std::min(64, mapWidth - x);
+                uint64_t word = 0;
+                uint8_t value;
+                if (tiles.isUniform(x, r, value)) {
+                    word = paletteWall[value] ? ~(uint64_t)0 : 0;
+                } else {
+                    const uint8_t *cells = tiles.span(x, r);
+                    for (int i = 0; i < n; i++) {
+                        word |= (uint64_t)paletteWall[cells[i]] << i;
+                    }
+                }
+                if (n < 64) word |= ~(uint64_t)0 << n;
+                out[j] = word;
+            }
+        }
+    }, 64);
+    
+    // Rows not streamed in count as wall
+    std::vector<uint64_t> allWall(words + 2, ~(uint64_t)0);
+    const uint64_t *outside = &allWall[1];
+    uint8_t cellFor[256];
+    for (int mask = 0; mask < 256; mask++) {
+        cellFor[mask] = variantCells[autotiler.variantFor((uint8_t)mask)];
+    }
+    
+    // Bands of whole storage chunk rows, so each band owns the chunks it writes
+    int bands = (rows + SparseTileGrid::CHUNK_MASK) >> SparseTileGrid::CHUNK_SHIFT;
+    pool->parallelFor(0, bands, [this, &walls, words, outside, &cellFor, rows](int b0, int b1) {
+        int r0 = b0 << SparseTileGrid::CHUNK_SHIFT;
+        int r1 = std::min(rows, b1 << SparseTileGrid::CHUNK_SHIFT);
+        uint8_t cells[64];
+        for (int r = r0; r < r1; r++) {
+            int y = mapRow(r);
+            if (y < 0 || y >= mapHeight) continue;
+            int up = y > 0 ? storageRow(y - 1) : -1;
+            int down = y + 1 < mapHeight ? storageRow(y + 1) : -1;
+            const uint64_t *u = up < 0 ? outside : walls.row(up);
+            const uint64_t *m = walls.row(r);
+            const uint64_t *d = down < 0 ? outside : walls.row(down);
             
-            SDL_RenderCopy(renderer, spritesheet, &srcRect, &dstRect);
+            // Neighbour words as in the cellular automaton: L holds each
+            // bit's west neighbour, R its east one. The map's left and right
+            // edges shift in wall.
+            for (int j = 0; j < words; j++) {
+                int x = j * 64;
+                int n = std::min(64, mapWidth - x);
+                uint64_t mC = m[j];
+                if (n < 64) mC &= ~(~(uint64_t)0 << n);
+                if (mC == 0) continue;
+                bool first = j == 0, last = j == words - 1;
+                uint64_t uC = u[j], dC = d[j];
+                uint64_t uL = (uC << 1) | (first ? 1 : u[j - 1] >> 63);
+                uint64_t mL = (m[j] << 1) | (first ? 1 : m[j - 1] >> 63);
+                uint64_t dL = (dC << 1) | (first ? 1 : d[j - 1] >> 63);
+                uint64_t uR = (uC >> 1) | ((last ? 1 : u[j + 1]) << 63);
+                uint64_t mR = (m[j] >> 1) | ((last ? 1 : m[j + 1]) << 63);
+                uint64_t dR = (dC >> 1) | ((last ? 1 : d[j + 1]) << 63);
+                
+                const uint8_t *current = tiles.span(x, r);
+                uint8_t interior = cellFor[0xFF];
+                uint64_t inner = mC & uC & dC & uL & mL & dL & uR & mR & dR;
+                uint8_t value;
+                if (inner == ~(uint64_t)0) {
+                    // Solid rock: 64 walls surrounded by walls
+                    if (!tiles.isUniform(x, r, value) || value != interior) {
+                        std::fill(cells, cells + n, interior);
+                        tiles.setRow(x, r, cells, n);
+                    }
+                    continue;
+                }
+                std::copy(current, current + n, cells);
+                for (uint64_t bits = inner; bits; bits &= bits - 1) {
+                    cells[__builtin_ctzll(bits)] = interior;
+                }
+                for (uint64_t bits = mC & ~inner; bits; bits &= bits - 1) {
+                    int b = __builtin_ctzll(bits);
+                    unsigned mask =
+                        ((uC >> b) & 1) | ((uR >> b) & 1) << 1 | ((mR >> b) & 1) << 2 |
+                        ((dR >> b) & 1) << 3 | ((dC >> b) & 1) << 4 | ((dL >> b) & 1) << 5 |
+                        ((mL >> b) & 1) << 6 | ((uL >> b) & 1) << 7;
+                    cells[b] = cellFor[mask];
+                }
+                // Write back only what changed, leaving shared chunks shared
+                if (!std::equal(cells, cells + n, current)) {
+                    tiles.setRow(x, r, cells, n);
+                }
+            }
+        }
+        tiles.compact(r0, r1);
+    });
+    rebuildSolidity(0, rows);
+    markMapReplaced();
+}
+
+void Tilemap::setSolidTiles(const std::vector<int> &tileIds) {
+    solidTileIds = tileIds;
+    for (size_t i = 0; i < palette.size(); i++) {
+        updatePaletteEntry((int)i);
+    }
+    rebuildSolidity(0, tiles.getHeight());
+}
+
+void Tilemap::rebuildSolidity(int row0, int row1) {
+    for (int y = row0; y < row1; y++) {
+        uint64_t *bits = solidity.row(y);
+        for (int w = 0; w < solidity.getWordsPerRow(); w++) {
+            // A word is exactly one storage chunk row wide
+            static_assert(SparseTileGrid::CHUNK_SIZE == 64, "solidity words must match storage chunks");
+            int x0 = w * 64;
+            int x1 = std::min(mapWidth, x0 + 64);
+            uint8_t value;
+            if (tiles.isUniform(x0, y, value)) {
+                bits[w] = paletteSolid[value] ? ~(uint64_t)0 >> (64 - (x1 - x0)) : 0;
+                continue;
+            }
+            const uint8_t *cells = tiles.span(x0, y);
+            uint64_t word = 0;
+            for (int x = 0; x < x1 - x0; x++) {
+                word |= (uint64_t)paletteSolid[cells[x]] << x;
+            }
+            bits[w] = word;
         }
     }
 }
@@ -181,12 +1812,110 @@ bool Tilemap::isSolidTile(int x, int y) const {
     if (x < 0 || x >= mapWidth || y < 0 || y >= mapHeight) {
         return true;  // Treat out of bounds as solid
     }
+    int row = storageRow(y);
+    if (row < 0) {
+        return true;  // Not streamed in yet
+    }
+    return solidity.get(x, row);
+}
+
+bool Tilemap::scanSolidRow(int y, int x0, int x1, std::vector<SDL_Point> *hits) const {
+    int row = (y >= 0 && y < mapHeight) ? storageRow(y) : -1;
+    if (row < 0) {
+        // The whole span is outside the map or not streamed in
+        if (!hits) return x0 <= x1;
+        for (int x = x0; x <= x1; x++) hits->push_back(SDL_Point{ x, y });
+        return x0 <= x1;
+    }
     
-    int tileIndex = tiles[y][x];
+    bool found = false;
+    for (int x = x0; x < std::min(x1 + 1, 0); x++) {
+        if (!hits) return true;
+        hits->push_back(SDL_Point{ x, y });
+        found = true;
+    }
+    
+    // Whole words of the in-map part, masked at both ends
+    int first = std::max(x0, 0);
+    int last = std::min(x1, mapWidth - 1);
+    const uint64_t *bits = solidity.row(row);
+    for (int w = first >> 6; first <= last && w <= last >> 6; w++) {
+        uint64_t word = bits[w];
+        if (w == first >> 6) word &= ~(uint64_t)0 << (first & 63);
+        if (w == last >> 6 && (last & 63) != 63) word &= ((uint64_t)1 << ((last & 63) + 1)) - 1;
+        if (word && !hits) return true;
+        while (word) {
+            hits->push_back(SDL_Point{ (w << 6) + __builtin_ctzll(word), y });
+            word &= word - 1;
+            found = true;
+        }
+    }
+    
+    for (int x = std::max(x0, mapWidth); x <= x1; x++) {
+        if (!hits) return true;
+        hits->push_back(SDL_Point{ x, y });
+        found = true;
+    }
+    return found;
+}
+
+bool Tilemap::scanSolid(const SweptBox &box, std::vector<SDL_Point> *hits) const {
+    // Tile rows the box touches anywhere along its path
+    float top = std::min(box.y, box.y + box.dy);
+    float bottom = std::max(box.y + box.h, box.y + box.h + box.dy);
+    int row0 = (int)std::floor(top / tileHeight);
+    int row1 = std::max(row0, (int)std::ceil(bottom / tileHeight) - 1);
     
-    // Tile index 0 and 4 are TILE_WALL and TILE_STONE (solid)
-    // Tile index 5 is TILE_FLOOR (walkable)
-    return (tileIndex == 0 || tileIndex == 4);
+    bool found = false;
+    for (int ty = row0; ty <= row1; ty++) {
+        // Part of the motion (t in [tlo, thi]) during which the box overlaps
+        // this row, and the horizontal extent it covers meanwhile
+        float tlo = 0.0f, thi = 1.0f;
+        if (box.dy != 0.0f) {
+            float enter = ((float)(ty * tileHeight) - box.y - box.h) / box.dy;
+            float leave = ((float)((ty + 1) * tileHeight) - box.y) / box.dy;
+            if (box.dy < 0.0f) std::swap(enter, leave);
+            tlo = std::max(tlo, enter);
+            thi = std::min(thi, leave);
+            if (tlo > thi) continue;
+        }
+        float left = box.x + std::min(tlo * box.dx, thi * box.dx);
+        float right = box.x + box.w + std::max(tlo * box.dx, thi * box.dx);
+        int col0 = (int)std::floor(left / tileWidth);
+        int col1 = std::max(col0, (int)std::ceil(right / tileWidth) - 1);
+        
+        if (scanSolidRow(ty, col0, col1, hits)) {
+            found = true;
+            if (!hits) return true;
+        }
+    }
+    return found;
+}
+
+int Tilemap::querySolid(float x, float y, float w, float h, std::vector<SDL_Point> &hits) const {
+    SweptBox box = { x, y, w, h, 0.0f, 0.0f };
+    return querySolidSwept(box, hits);
+}
+
+int Tilemap::querySolidSwept(const SweptBox &box, std::vector<SDL_Point> &hits) const {
+    size_t before = hits.size();
+    scanSolid(box, &hits);
+    return (int)(hits.size() - before);
+}
+
+bool Tilemap::overlapsSolid(float x, float y, float w, float h) const {
+    SweptBox box = { x, y, w, h, 0.0f, 0.0f };
+    return scanSolid(box, nullptr);
+}
+
+void Tilemap::querySolidBatch(const std::vector<SweptBox> &boxes, std::vector<SDL_Point> &hits,
+                              std::vector<int> &starts) const {
+    hits.clear();
+    starts.assign(1, 0);
+    for (size_t i = 0; i < boxes.size(); i++) {
+        scanSolid(boxes[i], &hits);
+        starts.push_back((int)hits.size());
+    }
 }
 
 int Tilemap::getTileAtWorldPos(float worldX, float worldY) const {
@@ -199,5 +1928,5 @@ int Tilemap::getTileAtWorldPos(float worldX, float worldY) const {
         return -1;  // Out of bounds
     }
     
-    return tiles[tileY][tileX];
+    return getTile(tileX, tileY);
 }
@@ -4,27 +4,294 @@
 #include <SDL2/SDL.h>
 #include <vector>
 #include <string>
+#include <functional>
+#include "grid.h"
+#include "tile_atlas.h"
+#include "bit_grid.h"
+#include "sparse_grid.h"
+#include "autotile.h"
+
+// SDL_RenderGeometry arrived in SDL 2.0.18
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+#define HAVE_RENDER_GEOMETRY 1
+#endif
+
+// Fills a chunkSize x chunkSize grid of palette indices for one chunk
+typedef std::function<void(int chunkX, int chunkY, TileGrid &chunk)> ChunkSource;
+
+// An axis-aligned box in world pixels moving by (dx, dy) this step; zero
+// motion makes it a plain AABB
+struct SweptBox {
+    float x, y;
+    float w, h;
+    float dx, dy;
+};
+
+// How renderViewport draws: one copy per tile, cached block textures, or
+// one SDL_RenderGeometry batch of tile quads
+enum TileRenderMode {
+    RENDER_TILES,
+    RENDER_CACHED_BLOCKS,
+    RENDER_GEOMETRY
+};
 
 class Tilemap {
 private:
     SDL_Texture *spritesheet;
     SDL_Renderer *renderer;
-    std::vector<std::vector<int>> tiles;
+    SparseTileGrid tiles;           // palette index per tile
+    std::vector<TileId> palette;    // palette index -> spritesheet tile id
     int tileWidth;
     int tileHeight;
     int mapWidth;   // in tiles
     int mapHeight;  // in tiles
-    int spritesheetCols;
-    int spritesheetRows;
-    static const int TILE_MARGIN = 1;
+    static const int MAX_PALETTE_SIZE = 256;
+    
+    // Spritesheet layout, and the source rect of each palette entry so the
+    // draw loops need one table load per tile (w == 0: draw nothing)
+    TileAtlas atlas;
+    int sheetWidth;
+    int sheetHeight;
+    SDL_Rect paletteRects[MAX_PALETTE_SIZE];
+    
+    // Solidity: one bit per tile in the same storage rows as tiles, set
+    // where the palette entry's tile id is in solidTileIds
+    std::vector<int> solidTileIds;
+    bool paletteSolid[MAX_PALETTE_SIZE];
+    BitGrid solidity;
+    
+    // Autotiling (autotileWall >= 0): palette entries that count as wall,
+    // and the palette entry showing each of the autotiler's variants
+    Autotiler autotiler;
+    int autotileWall;
+    bool paletteWall[MAX_PALETTE_SIZE];
+    std::vector<uint8_t> variantCells;
+    
+    // Streaming mode: tiles holds a ring of chunk rows, slot s holding the
+    // chunk row recorded in slotChunkRow[s] (-1 = empty)
+    ChunkSource chunkSource;
+    int chunkSize;
+    std::vector<int> slotChunkRow;
+    TileGrid chunkScratch;
+    
+    // The map is split into BLOCK_TILES square blocks, numbered row-major,
+    // the unit of change tracking and of the render cache
+    int blocksAcross;
+    int blocksDown;
+    
+    // Change journal: a bit per block, plus each changed block once in the
+    // order it first changed since the last drainChangedBlocks
+    std::vector<uint64_t> changedBits;
+    std::vector<int> changedBlocks;
+    bool mapReplaced;
+    
+    // Minimap pyramid: level 0 has a pixel per tile of storage, each level
+    // after it averages 2x2 pixels of the one before. All levels share one
+    // streaming texture (level 0 on the left, the rest stacked beside it),
+    // mirrored in minimapPixels and patched a block of storage at a time.
+    int minimapLevelCount;                  // requested; 0 = off
+    SDL_Texture *minimapTexture;
+    std::vector<uint32_t> minimapPixels;    // premultiplied ARGB
+    int minimapPitch;                       // pixels per row
+    std::vector<SDL_Rect> minimapLevels;    // each level's area of the texture
+    std::vector<uint64_t> minimapDirtyBits; // per storage block
+    std::vector<int> minimapDirty;
+    bool minimapStale;                      // everything needs redrawing
+    bool minimapFailed;                     // no texture; until enableMinimap
+    float lodZoom;                          // below this, draw from the pyramid
+    std::vector<uint32_t> tileColours;      // average of each atlas tile
+    uint32_t paletteColours[MAX_PALETTE_SIZE];
+    
+    // Tile animation: palette entries showing an animated tile id cycle
+    // through its frames. animatedCells lists, per block of the map, the
+    // resident cells that animate (y * BLOCK_TILES + x within the block),
+    // so a frame change redraws those cells and nothing else.
+    struct TileAnimation {
+        TileId tile;
+        std::vector<TileId> frames;
+        std::vector<Uint32> durations;  // ms each frame is shown
+        Uint32 period;                  // sum of durations
+        int current;                    // frame on screen
+        bool changed;                   // current moved in this update
+    };
+    std::vector<TileAnimation> animations;
+    int paletteAnimation[MAX_PALETTE_SIZE];             // -1 = not animated
+    std::vector<std::vector<uint16_t> > animatedCells;
+    std::vector<int> animatedBlocks;                    // blocks listing cells
+    std::vector<bool> animatedListed;                   // block is in animatedBlocks
+    int animatedCellCount;
+    bool animationIndexStale;                           // rebuild on next update
+    
+    // Extra layers (ids 1..N; 0 is the map above). Each has its own palette
+    // and sparse storage the size of the map; it is not streamed and not
+    // part of collision or the change journal.
+    struct TileLayer {
+        SparseTileGrid cells;
+        std::vector<TileId> palette;
+        SDL_Rect rects[MAX_PALETTE_SIZE];
+        int depth;              // < 0 behind the map, otherwise in front
+        float parallax;         // camera motion scale; < 1 looks farther away
+        Uint8 opacity;
+        bool visible;
+        bool isStatic;          // baked blocks are evicted last
+        std::vector<int> blockSlot;     // block -> render cache entry
+    };
+    std::vector<TileLayer> layers;
+    std::vector<int> layerOrder;        // layer ids by depth
+    
+    // Render cache: blocks baked into target textures, reused least
+    // recently drawn first once the budget is spent. renderChunkSlot maps
+    // each block of the map to its entry (-1 = none), a layer's blockSlot
+    // each of its blocks.
+    struct RenderChunk {
+        SDL_Texture *texture;
+        int layer;
+        int chunk;              // block index, -1 if the texture is free
+        unsigned int lastUsed;  // renderFrame it was last drawn in
+        bool dirty;
+    };
+    std::vector<RenderChunk> renderChunks;
+    std::vector<int> renderChunkSlot;
+    size_t renderCacheBudget;
+    unsigned int renderFrame;
+    TileRenderMode renderMode;
+    SDL_BlendMode renderChunkBlend;
+    
+#ifdef HAVE_RENDER_GEOMETRY
+    // Geometry batch: a quad per tile of geometryRange, positioned relative
+    // to its top-left tile. Rebuilt only when the range moves or a tile
+    // changes; scrolling within a tile just offsets geometryBase.
+    std::vector<SDL_Vertex> geometryVertices;
+    std::vector<SDL_FPoint> geometryBase;
+    std::vector<int> geometryIndices;
+    SDL_Rect geometryRange;     // in tiles
+    bool geometryValid;
+    float geometryOffsetX;
+    float geometryOffsetY;
+    float geometryZoom;
+    // First vertex and palette entry of each animated quad
+    struct AnimatedQuad {
+        int vertex;
+        uint8_t cell;
+    };
+    std::vector<AnimatedQuad> geometryAnimated;
+    
+    // Tiles touching the view, clamped to the map
+    SDL_Rect geometryRangeFor(float cameraX, float cameraY, int screenWidth, int screenHeight, float zoom) const;
+    void buildGeometry(const SDL_Rect &range);
+    bool renderGeometry(float cameraX, float cameraY, const SDL_Rect &range, float zoom);
+#endif
+    
+    // Find (or add) the palette entry for a spritesheet tile index; -1 if full
+    int paletteIndex(int tileIndex);
+    bool setPalette(const std::vector<int> &cellPalette);
+    // Refresh the cached source rect and solidity of a palette entry
+    void updatePaletteEntry(int index);
+    
+    // Recompute solidity bits for storage rows [row0, row1)
+    void rebuildSolidity(int row0, int row1);
+    // Append solid tiles of map row y in columns [x0, x1]; tiles outside the
+    // map or not streamed in count as solid. Stops at the first if asked.
+    bool scanSolidRow(int y, int x0, int x1, std::vector<SDL_Point> *hits) const;
+    bool scanSolid(const SweptBox &box, std::vector<SDL_Point> *hits) const;
+    
+    // Row of tiles holding map row y, or -1 if it is not resident
+    int storageRow(int y) const;
+    // Map row held in storage row, or -1 if the slot is empty
+    int mapRow(int row) const;
+    
+    // Store a palette index and update solidity and change tracking
+    void writeCell(int x, int y, int row, uint8_t index);
+    // Make sure every variant has a palette entry
+    bool refreshAutotilePalette();
+    // Wall neighbour mask of map cell (x, y); outside the map and rows not
+    // streamed in count as wall
+    uint8_t wallMask(int x, int y) const;
+    // Retile the walls in [x0, x1] x [y0, y1], or all resident rows
+    void retile(int x0, int y0, int x1, int y1);
+    void retileAll();
+    
+    void loadChunkRow(int chunkRow);
+    
+    // Draw the tile for one palette index into a w x h rect at (x, y)
+    void drawCell(const SDL_Rect *rects, uint8_t cell, int x, int y, int w, int h);
+    
+    // Per-layer views (0 = the map): storage, the storage row of map row y
+    // (-1 if not resident), palette and source rects
+    const SparseTileGrid& layerCells(int layer) const;
+    int layerRow(int layer, int y) const;
+    const std::vector<TileId>& layerPalette(int layer) const;
+    const SDL_Rect* layerRects(int layer) const;
+    std::vector<int>& blockSlots(int layer);
+    TileLayer* findLayer(int layer);
+    const TileLayer* findLayer(int layer) const;
+    // True if the block lies in one uniform storage chunk that draws nothing
+    bool isBlockEmpty(int layer, int block) const;
+    void updateLayerRect(TileLayer &layer, int index);
+    
+    // Size the block grid for the map; everything counts as replaced
+    void resetBlocks();
+    // Invalidate whatever depends on the changed tiles
+    void markBlockChanged(int block);
+    void markRowsChanged(int y0, int y1);
+    void markMapReplaced();
+    
+    // Premultiplied average colour of every atlas tile
+    void computeTileColours(SDL_Surface *surface);
+    // Queue the storage block holding (x, row), or storage rows [row0, row1)
+    void markMinimapChanged(int x, int row);
+    void markMinimapRows(int row0, int row1);
+    // Lay out and fill the whole pyramid if stale, otherwise redraw and
+    // upload the queued blocks; false if there is no texture
+    bool updateMinimap();
+    // Redraw one storage block in every level
+    void drawMinimapBlock(int block);
+    void uploadMinimapBlock(int block);
+    
+    // List or unlist map cell (x, y) in its block's animated cells
+    void indexAnimatedCell(int x, int y, bool animated);
+    // Re-list the animated cells of map rows [y0, y1), or of everything
+    // resident
+    void indexAnimatedRows(int y0, int y1);
+    void rebuildAnimationIndex();
+    // Point palette entries at their animation's current frame
+    void refreshAnimatedPalette();
+    // Redraw the listed cells of a baked block whose frame changed
+    void patchAnimatedBlock(RenderChunk &entry, const std::vector<uint16_t> &cells);
+    
+    void dropRenderCache();
+    RenderChunk* acquireRenderChunk(int layer, int chunk);
+    void bakeRenderChunk(RenderChunk &entry);
+    void renderViewportTiles(int layer, float cameraX, float cameraY, int screenWidth, int screenHeight,
+                             float zoom);
+    // Draw the layer's tiles in range (in tiles, clamped to the map) one by one
+    void renderTiles(int layer, float cameraX, float cameraY, const SDL_Rect &range, float zoom);
+    void renderViewportBlocks(int layer, float cameraX, float cameraY, int screenWidth, int screenHeight,
+                              float zoom);
+    // The map from the minimap pyramid level nearest the zoom; false if
+    // there is no pyramid to draw from
+    bool renderViewportLod(float cameraX, float cameraY, int screenWidth, int screenHeight, float zoom);
+    // Draw the visible layers with depth in [minDepth, maxDepth]
+    void renderLayers(int minDepth, int maxDepth, float cameraX, float cameraY,
+                      int screenWidth, int screenHeight, float zoom);
     
 public:
     Tilemap(SDL_Renderer *renderer, const std::string &imagePath, 
             int tileW, int tileH, int mapW, int mapH);
     ~Tilemap();
     
+    // Loads the image and the layout from spritesheetInfo.txt beside it
+    // (keeping the current layout if there is none)
     bool loadSpritesheet(const std::string &imagePath);
+    const TileAtlas& getAtlas() const { return atlas; }
     bool loadMapFromArray(const int *mapData);
+    // Take a generated map; a dense grid is compressed (uniform 64x64
+    // chunks become one value each) and released
+    bool loadMap(TileGrid &&cells, const std::vector<int> &cellPalette);
+    bool loadMap(SparseTileGrid &&cells, const std::vector<int> &cellPalette);
+    // Bytes held for tiles, and how many storage chunks are mixed
+    size_t getTileMemoryUsage() const { return tiles.getMemoryUsage(); }
+    int getDenseChunkCount() const { return tiles.getDenseChunkCount(); }
     void render(float offsetX = 0, float offsetY = 0);
     void setTile(int x, int y, int tileIndex);
     int getTile(int x, int y) const;
@@ -33,12 +300,138 @@ public:
     // Helper to get position
     void clear();
     
-    // Camera/viewport support for large maps
-    void renderViewport(float cameraX, float cameraY, int screenWidth, int screenHeight);
+    // Camera/viewport support for large maps. By default visible blocks are
+    // baked into cached textures, so a frame costs a few blits instead of one
+    // per tile; without render targets the tiles go out as one geometry batch.
+    // Draws the layers behind the map first; blocks that are empty in a
+    // layer are skipped.
+    // (cameraX, cameraY) is the world pixel at the top-left of the screen
+    // and zoom the screen pixels per world pixel, so the view spans
+    // screenWidth / zoom world pixels. Below the LOD zoom the map is drawn
+    // from the minimap pyramid instead (enabled on first use): one copy of
+    // the level nearest one pixel per texel, whatever the zoom. Extra
+    // layers are not drawn at that distance. If the pyramid cannot be
+    // built, every zoom is drawn at full detail.
+    void renderViewport(float cameraX, float cameraY, int screenWidth, int screenHeight, float zoom = 1.0f);
+    // Layers in front of the map, drawn after the sprites they should cover
+    void renderOverlays(float cameraX, float cameraY, int screenWidth, int screenHeight, float zoom = 1.0f);
+    void setLodZoom(float zoom) { lodZoom = zoom; }
+    float getLodZoom() const { return lodZoom; }
+    // A tile a quarter of its size: 35 or so 512x512 blocks fill an 800x600 view
+    static constexpr float DEFAULT_LOD_ZOOM = 0.25f;
+    
+    // Layers. addLayer returns the new layer's id; layers draw in order of
+    // depth, those below 0 under the map and the rest by renderOverlays,
+    // offset by camera * parallax and blended at opacity. Layers start
+    // empty (palette entry 0 draws nothing) and are cleared if the map is
+    // resized.
+    // Layers are drawn from cached blocks in RENDER_CACHED_BLOCKS mode and
+    // tile by tile otherwise.
+    int addLayer(int depth, float parallax = 1.0f, Uint8 opacity = 255);
+    int getLayerCount() const { return (int)layers.size() + 1; }
+    bool loadLayer(int layer, SparseTileGrid &&cells, const std::vector<int> &cellPalette);
+    void setLayerTile(int layer, int x, int y, int tileIndex);
+    int getLayerTile(int layer, int x, int y) const;
+    void setLayerParallax(int layer, float parallax);
+    void setLayerOpacity(int layer, Uint8 opacity);
+    void setLayerVisible(int layer, bool visible);
+    // For layers that no longer change: their baked blocks are reused for
+    // other blocks only when nothing else can be
+    void setLayerStatic(int layer, bool isStatic);
     
-    // Check if tile at position is solid (wall)
+    // False (keeping the current mode) if the renderer or SDL lacks support
+    bool setRenderMode(TileRenderMode mode);
+    TileRenderMode getRenderMode() const { return renderMode; }
+    
+    // Texture memory the render cache may hold (it still keeps whatever one
+    // frame needs); drop cached textures after SDL_RENDER_TARGETS_RESET
+    void setRenderCacheBudget(size_t bytes);
+    void invalidateRenderCache();
+    int getRenderCacheSize() const { return (int)renderChunks.size(); }
+    static const size_t DEFAULT_RENDER_CACHE_BYTES = 64u << 20;
+    
+    // Edit tracking for derived data (collision, lighting, ...). Fills blocks
+    // with every block whose tiles changed since the last call, once each,
+    // in the order they first changed; cost is proportional to the edits.
+    // Returns true instead if the whole map was replaced (loadMap, clear,
+    // enableStreaming), meaning derived data needs a full rebuild.
+    bool drainChangedBlocks(std::vector<int> &blocks);
+    int getBlocksAcross() const { return blocksAcross; }
+    int getBlocksDown() const { return blocksDown; }
+    // Tiles covered by a block, clipped to the map
+    SDL_Rect getBlockRect(int block) const;
+    static const int BLOCK_TILES = 32;
+    
+    // Streaming: generate chunk rows on demand instead of holding the whole
+    // map. The map becomes height tiles deep (0: STREAM_MAP_HEIGHT); only
+    // residentChunkRows rows of chunks are kept, and a row is dropped when
+    // another row needs its slot. Edits to evicted rows are not kept.
+    bool enableStreaming(const ChunkSource &source, const std::vector<int> &cellPalette,
+                         int chunkSize, int residentChunkRows, int height = 0);
+    
+    // Map files (tilemap_file.h). openMapFile maps the file and streams it,
+    // decoding chunks only as their rows come into view; the tilemap takes
+    // the file's size. saveMap writes a map that is fully in memory.
+    bool openMapFile(const std::string &path, int residentChunkRows);
+    bool saveMap(const std::string &path, int chunkSize = 64) const;
+    bool isStreaming() const { return !slotChunkRow.empty(); }
+    // Load the chunk rows covering the view plus one row of margin each way
+    void streamAround(float cameraX, float cameraY, int screenWidth, int screenHeight);
+    bool isRowResident(int y) const { return storageRow(y) >= 0; }
+    // Deep enough to be endless, shallow enough for exact float pixel coordinates
+    static const int STREAM_MAP_HEIGHT = 1 << 18;
+    
+    // Minimap: the map at a pixel per tile (level 0) and halved per level
+    // after that, kept up to date by edits and streaming block by block.
+    // renderMinimap draws the tiles in area (the whole map if null) from
+    // one level into dst with a single copy (streamed maps: one per run of
+    // resident rows, at most two). levels is clamped to 1..6.
+    void enableMinimap(int levels = 3);
+    // Levels the pyramid holds, building it if needed: fewer than asked
+    // when streaming chunk rows do not divide evenly, 0 if it is off or
+    // its texture could not be made
+    int getMinimapLevelCount();
+    bool renderMinimap(int level, const SDL_Rect *area, const SDL_Rect &dst);
+    
+    // Animated tiles: cells showing tileId cycle through frames, frame i
+    // shown for durations[i] ms (replacing any animation of that tile).
+    // updateAnimations moves every animation to the frame for ticks and
+    // redraws only the cells that animate: in baked blocks, the geometry
+    // batch and the palette's source rects. Cost follows the number of
+    // animated tiles, not the view. The map layer only; the minimap keeps
+    // the base tile's colour.
+    bool addAnimation(int tileId, const std::vector<int> &frames, const std::vector<Uint32> &durations);
+    void clearAnimations();
+    void updateAnimations(Uint32 ticks);
+    // Resident cells listed as animated as of the last update
+    int getAnimatedTileCount() const { return animatedCellCount; }
+    
+    // Autotiling: cells set to wallTile or any of the rules' variant tiles
+    // are walls, and each shows the variant for its 8 neighbours. The whole
+    // map is retiled now and whenever it is replaced (in parallel); after
+    // that setTile and streaming retile only the 3x3 around each change,
+    // so drawing never scans neighbours. Empty rules turn it off.
+    bool setAutotiler(const Autotiler &rules, int wallTile);
+    
+    // Tile ids that block movement (0 and 4 unless set); rebuilds the
+    // solidity layer, which setTile and streaming then keep up to date
+    void setSolidTiles(const std::vector<int> &tileIds);
+    const std::vector<int>& getSolidTiles() const { return solidTileIds; }
+    
+    // Check if tile at position is solid (wall); outside the map is solid
     bool isSolidTile(int x, int y) const;
     
+    // Solid tiles (in tile coordinates) overlapping a box in world pixels,
+    // or everything it passes through while moving. Hits are appended to
+    // hits; the return value is how many. Rows are scanned 64 tiles a word.
+    int querySolid(float x, float y, float w, float h, std::vector<SDL_Point> &hits) const;
+    int querySolidSwept(const SweptBox &box, std::vector<SDL_Point> &hits) const;
+    // Whether any solid tile overlaps, stopping at the first
+    bool overlapsSolid(float x, float y, float w, float h) const;
+    // One query per box: box i's hits are hits[starts[i]] .. hits[starts[i + 1] - 1]
+    void querySolidBatch(const std::vector<SweptBox> &boxes, std::vector<SDL_Point> &hits,
+                         std::vector<int> &starts) const;
+    
     // Get tile type at world position (in pixels)
     int getTileAtWorldPos(float worldX, float worldY) const;
 };
@@ -0,0 +1,409 @@
+#include "tilemap_file.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+const int TilemapFile::MAX_CHUNK_SIZE;
+
+static const char MAGIC[4] = { 'T', 'M', 'A', 'P' };
+static const int VERSION = 1;
+static const size_t HEADER_SIZE = 32;
+static const size_t INDEX_ENTRY_SIZE = 16;
+
+static const int LZ_MIN_MATCH = 4;
+static const int LZ_MAX_OFFSET = 65535;
+static const int LZ_HASH_BITS = 12;
+
+// Little-endian fields
+
+static void put16(std::vector<uint8_t> &out, uint32_t v) {
+    out.push_back((uint8_t)v);
+    out.push_back((uint8_t)(v >> 8));
+}
+
+static void put32(std::vector<uint8_t> &out, uint32_t v) {
+    put16(out, v & 0xFFFF);
+    put16(out, v >> 16);
+}
+
+static void put64(std::vector<uint8_t> &out, uint64_t v) {
+    put32(out, (uint32_t)v);
+    put32(out, (uint32_t)(v >> 32));
+}
+
+static uint32_t get16(const uint8_t *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8);
+}
+
+static uint32_t get32(const uint8_t *p) {
+    return get16(p) | (get16(p + 2) << 16);
+}
+
+static uint64_t get64(const uint8_t *p) {
+    return (uint64_t)get32(p) | ((uint64_t)get32(p + 4) << 32);
+}
+
+// RLE: (value, LEB128 run length) pairs
+
+static void rleEncode(const uint8_t *src, size_t n, std::vector<uint8_t> &out) {
+    size_t i = 0;
+    while (i < n) {
+        size_t run = 1;
+        while (i + run < n && src[i + run] == src[i]) run++;
+        out.push_back(src[i]);
+        for (size_t r = run; ; r >>= 7) {
+            if (r < 0x80) {
+                out.push_back((uint8_t)r);
+                break;
+            }
+            out.push_back((uint8_t)(r | 0x80));
+        }
+        i += run;
+    }
+}
+
+static bool rleDecode(const uint8_t *in, size_t inSize, uint8_t *dst, size_t n) {
+    size_t pos = 0;
+    size_t out = 0;
+    while (out < n) {
+        if (pos >= inSize) return false;
+        uint8_t value = in[pos++];
+        size_t run = 0;
+        for (int shift = 0; ; shift += 7) {
+            if (pos >= inSize || shift > 28) return false;
+            uint8_t b = in[pos++];
+            run |= (size_t)(b & 0x7F) << shift;
+            if (!(b & 0x80)) break;
+        }
+        if (run == 0 || run > n - out) return false;
+        std::memset(dst + out, value, run);
+        out += run;
+    }
+    return pos == inSize;
+}
+
+// LZ: sequences of a token (literal count << 4 | match length - 4, 15 means
+// more bytes follow, each adding up to 255), the literals, then a 16-bit
+// offset back into the output. The last sequence has literals only.
+
+static void putLength(std::vector<uint8_t> &out, size_t rest) {
+    while (rest >= 255) {
+        out.push_back(255);
+        rest -= 255;
+    }
+    out.push_back((uint8_t)rest);
+}
+
+static void putSequence(std::vector<uint8_t> &out, const uint8_t *literals, size_t literalCount,
+                        size_t offset, size_t matchLength) {
+    size_t matchCode = matchLength ? matchLength - LZ_MIN_MATCH : 0;
+    out.push_back((uint8_t)((std::min<size_t>(literalCount, 15) << 4) | std::min<size_t>(matchCode, 15)));
+    if (literalCount >= 15) putLength(out, literalCount - 15);
+    out.insert(out.end(), literals, literals + literalCount);
+    if (!matchLength) return;
+    put16(out, (uint32_t)offset);
+    if (matchCode >= 15) putLength(out, matchCode - 15);
+}
+
+static uint32_t read32(const uint8_t *p) {
+    uint32_t v;
+    std::memcpy(&v, p, 4);
+    return v;
+}
+
+static void lzEncode(const uint8_t *src, size_t n, std::vector<uint8_t> &out) {
+    std::vector<int> table((size_t)1 << LZ_HASH_BITS, -1);
+    size_t anchor = 0;
+    size_t i = 0;
+    while (i + LZ_MIN_MATCH <= n) {
+        uint32_t sequence = read32(src + i);
+        uint32_t hash = (sequence * 2654435761u) >> (32 - LZ_HASH_BITS);
+        int candidate = table[hash];
+        table[hash] = (int)i;
+        if (candidate >= 0 && i - candidate <= (size_t)LZ_MAX_OFFSET &&
+            read32(src + candidate) == sequence) {
+            size_t length = LZ_MIN_MATCH;
+            while (i + length < n && src[candidate + length] == src[i + length]) length++;
+            putSequence(out, src + anchor, i - anchor, i - candidate, length);
+            i += length;
+            anchor = i;
+        } else {
+            i++;
+        }
+    }
+    putSequence(out, src + anchor, n - anchor, 0, 0);
+}
+
+static bool getLength(const uint8_t *in, size_t inSize, size_t &pos, size_t &length) {
+    for (;;) {
+        if (pos >= inSize) return false;
+        uint8_t b = in[pos++];
+        length += b;
+        if (b != 255) return true;
+    }
+}
+
+static bool lzDecode(const uint8_t *in, size_t inSize, uint8_t *dst, size_t n) {
+    size_t pos = 0;
+    size_t out = 0;
+    for (;;) {
+        if (pos >= inSize) return false;
+        uint8_t token = in[pos++];
+        size_t literals = token >> 4;
+        if (literals == 15 && !getLength(in, inSize, pos, literals)) return false;
+        if (literals > inSize - pos || literals > n - out) return false;
+        std::memcpy(dst + out, in + pos, literals);
+        pos += literals;
+        out += literals;
+        if (out == n) return pos == inSize;
+
+        if (inSize - pos < 2) return false;
+        size_t offset = get16(in + pos);
+        pos += 2;
+        size_t length = token & 15;
+        if (length == 15 && !getLength(in, inSize, pos, length)) return false;
+        length += LZ_MIN_MATCH;
+        if (offset == 0 || offset > out || length > n - out) return false;
+        // Byte by byte: the match may overlap what it is copying
+        for (size_t k = 0; k < length; k++, out++) {
+            dst[out] = dst[out - offset];
+        }
+    }
+}
+
+TilemapFile::TilemapFile()
+    : data(nullptr), fileSize(0), width(0), height(0), chunkSize(0),
+      chunksAcross(0), chunksDown(0), index(nullptr) {
+}
+
+TilemapFile::~TilemapFile() {
+    close();
+}
+
+void TilemapFile::close() {
+    if (data) {
+        munmap((void*)data, fileSize);
+    }
+    data = nullptr;
+    index = nullptr;
+    fileSize = 0;
+    width = height = chunkSize = chunksAcross = chunksDown = 0;
+    palette.clear();
+}
+
+bool TilemapFile::open(const std::string &path) {
+    close();
+
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        std::cerr << "Cannot open map file: " << path << std::endl;
+        return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || (size_t)info.st_size < HEADER_SIZE) {
+        std::cerr << "Map file too small: " << path << std::endl;
+        ::close(fd);
+        return false;
+    }
+    void *mapped = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapped == MAP_FAILED) {
+        std::cerr << "Cannot map " << path << std::endl;
+        return false;
+    }
+    data = (const uint8_t*)mapped;
+    fileSize = (size_t)info.st_size;
+
+    // Header
+    uint32_t paletteSize = get32(data + 16);
+    uint64_t indexOffset = get64(data + 24);
+    width = (int)get32(data + 8);
+    height = (int)get32(data + 12);
+    chunkSize = (int)get16(data + 6);
+    if (std::memcmp(data, MAGIC, 4) != 0 || (int)get16(data + 4) != VERSION) {
+        std::cerr << path << " is not a version " << VERSION << " map file" << std::endl;
+        close();
+        return false;
+    }
+    if (width <= 0 || height <= 0 || chunkSize <= 0 || chunkSize > MAX_CHUNK_SIZE ||
+        paletteSize == 0 || paletteSize > 256 ||
+        HEADER_SIZE + paletteSize * 2 > fileSize) {
+        std::cerr << "Bad map file header: " << path << std::endl;
+        close();
+        return false;
+    }
+
+    palette.resize(paletteSize);
+    for (uint32_t i = 0; i < paletteSize; i++) {
+        uint32_t id = get16(data + HEADER_SIZE + i * 2);
+        palette[i] = id == 0xFFFF ? -1 : (int)id;
+    }
+
+    chunksAcross = (width + chunkSize - 1) / chunkSize;
+    chunksDown = (height + chunkSize - 1) / chunkSize;
+    uint64_t indexSize = (uint64_t)chunksAcross * chunksDown * INDEX_ENTRY_SIZE;
+    if (indexOffset > fileSize || indexSize > fileSize - indexOffset) {
+        std::cerr << "Map file index out of range: " << path << std::endl;
+        close();
+        return false;
+    }
+    index = data + indexOffset;
+    return true;
+}
+
+bool TilemapFile::readChunk(int chunkX, int chunkY, TileGrid &out) const {
+    if (out.getWidth() != chunkSize || out.getHeight() != chunkSize) {
+        out.resize(chunkSize, chunkSize, 0);
+    }
+    if (!data || chunkX < 0 || chunkY < 0 || chunkX >= chunksAcross || chunkY >= chunksDown) {
+        out.fill(0);
+        return false;
+    }
+
+    const uint8_t *entry = index + ((size_t)chunkY * chunksAcross + chunkX) * INDEX_ENTRY_SIZE;
+    uint64_t offset = get64(entry);
+    uint32_t size = get32(entry + 8);
+    uint8_t codec = entry[12];
+    size_t cells = (size_t)chunkSize * chunkSize;
+
+    bool ok = offset <= fileSize && size <= fileSize - offset;
+    if (ok) {
+        const uint8_t *payload = data + offset;
+        if (codec == CODEC_RAW) {
+            ok = size == cells;
+            if (ok) std::memcpy(out.data(), payload, cells);
+        } else if (codec == CODEC_RLE) {
+            ok = rleDecode(payload, size, out.data(), cells);
+        } else if (codec == CODEC_LZ) {
+            ok = lzDecode(payload, size, out.data(), cells);
+        } else {
+            ok = false;
+        }
+    }
+    // Every cell has to name a palette entry
+    if (ok && palette.size() < 256) {
+        const uint8_t *cell = out.data();
+        uint8_t limit = (uint8_t)palette.size();
+        for (size_t i = 0; i < cells && ok; i++) {
+            ok = cell[i] < limit;
+        }
+    }
+    if (!ok) {
+        std::cerr << "Damaged map chunk " << chunkX << "," << chunkY << std::endl;
+        out.fill(0);
+    }
+    return ok;
+}
+
+// Copy count cells of row y from column x
+static void copyCells(const TileGrid &cells, int x, int y, int count, uint8_t *dst) {
+    std::memcpy(dst, cells.row(y) + x, count);
+}
+
+static void copyCells(const SparseTileGrid &cells, int x, int y, int count, uint8_t *dst) {
+    while (count > 0) {
+        int n = std::min(count, SparseTileGrid::spanLength(x));
+        std::memcpy(dst, cells.span(x, y), n);
+        x += n;
+        dst += n;
+        count -= n;
+    }
+}
+
+template <typename Cells>
+static bool writeMap(const std::string &path, const Cells &cells,
+                     const std::vector<int> &palette, int chunkSize) {
+    if (cells.empty() || chunkSize <= 0 || chunkSize > TilemapFile::MAX_CHUNK_SIZE ||
+        palette.empty() || palette.size() > 256) {
+        std::cerr << "Cannot save map: bad size, chunk size or palette" << std::endl;
+        return false;
+    }
+
+    int width = cells.getWidth();
+    int height = cells.getHeight();
+    int chunksAcross = (width + chunkSize - 1) / chunkSize;
+    int chunksDown = (height + chunkSize - 1) / chunkSize;
+    size_t chunkCount = (size_t)chunksAcross * chunksDown;
+
+    std::vector<uint8_t> head;
+    head.insert(head.end(), MAGIC, MAGIC + 4);
+    put16(head, VERSION);
+    put16(head, (uint32_t)chunkSize);
+    put32(head, (uint32_t)width);
+    put32(head, (uint32_t)height);
+    put32(head, (uint32_t)palette.size());
+    put32(head, 0);
+    uint64_t indexOffset = (HEADER_SIZE + palette.size() * 2 + 7) & ~(uint64_t)7;
+    put64(head, indexOffset);
+    for (size_t i = 0; i < palette.size(); i++) {
+        put16(head, (palette[i] < 0 || palette[i] >= 0xFFFF) ? 0xFFFF : (uint32_t)palette[i]);
+    }
+    head.resize((size_t)indexOffset, 0);
+
+    // Compress every chunk, keeping the smallest encoding
+    std::vector<uint8_t> index;
+    std::vector<uint8_t> payloads;
+    std::vector<uint8_t> chunk((size_t)chunkSize * chunkSize);
+    std::vector<uint8_t> rle, lz;
+    uint64_t payloadStart = indexOffset + chunkCount * INDEX_ENTRY_SIZE;
+    for (int cy = 0; cy < chunksDown; cy++) {
+        for (int cx = 0; cx < chunksAcross; cx++) {
+            std::fill(chunk.begin(), chunk.end(), 0);
+            int x0 = cx * chunkSize;
+            int columns = std::min(chunkSize, width - x0);
+            for (int y = 0; y < chunkSize && cy * chunkSize + y < height; y++) {
+                copyCells(cells, x0, cy * chunkSize + y, columns, &chunk[(size_t)y * chunkSize]);
+            }
+
+            rle.clear();
+            lz.clear();
+            rleEncode(chunk.data(), chunk.size(), rle);
+            lzEncode(chunk.data(), chunk.size(), lz);
+            const std::vector<uint8_t> *best = &chunk;
+            uint8_t codec = TilemapFile::CODEC_RAW;
+            if (rle.size() < best->size()) {
+                best = &rle;
+                codec = TilemapFile::CODEC_RLE;
+            }
+            if (lz.size() < best->size()) {
+                best = &lz;
+                codec = TilemapFile::CODEC_LZ;
+            }
+
+            put64(index, payloadStart + payloads.size());
+            put32(index, (uint32_t)best->size());
+            index.push_back(codec);
+            index.insert(index.end(), 3, 0);
+            payloads.insert(payloads.end(), best->begin(), best->end());
+        }
+    }
+
+    std::ofstream out(path.c_str(), std::ios::binary);
+    if (!out) {
+        std::cerr << "Cannot write " << path << std::endl;
+        return false;
+    }
+    out.write((const char*)head.data(), head.size());
+    out.write((const char*)index.data(), index.size());
+    out.write((const char*)payloads.data(), payloads.size());
+    if (!out) {
+        std::cerr << "Failed writing " << path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool TilemapFile::save(const std::string &path, const TileGrid &cells,
+                       const std::vector<int> &palette, int chunkSize) {
+    return writeMap(path, cells, palette, chunkSize);
+}
+
+bool TilemapFile::save(const std::string &path, const SparseTileGrid &cells,
+                       const std::vector<int> &palette, int chunkSize) {
+    return writeMap(path, cells, palette, chunkSize);
+}
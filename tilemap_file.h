@@ -0,0 +1,76 @@
+#ifndef TILEMAP_FILE_H
+#define TILEMAP_FILE_H
+
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include "grid.h"
+#include "sparse_grid.h"
+
+// Chunked map file. The map is cut into chunkSize squares, each compressed
+// on its own, so a reader maps the file and decodes only the chunks it
+// touches. All integers are little-endian.
+//
+//   header   32 bytes: "TMAP", u16 version, u16 chunkSize, u32 width,
+//            u32 height, u32 paletteSize, u32 reserved, u64 indexOffset
+//   palette  paletteSize x u16 spritesheet tile id (0xFFFF = none)
+//   index    one 16-byte entry per chunk, row-major: u64 offset,
+//            u32 size, u8 codec, 3 bytes padding
+//   payloads chunkSize * chunkSize palette indices per chunk, cells past
+//            the map edge stored as 0
+class TilemapFile {
+private:
+    const uint8_t *data;
+    size_t fileSize;
+    int width;
+    int height;
+    int chunkSize;
+    int chunksAcross;
+    int chunksDown;
+    std::vector<int> palette;
+    const uint8_t *index;
+
+public:
+    // Payload encodings; the writer keeps whichever is smallest per chunk
+    enum Codec {
+        CODEC_RAW = 0,
+        CODEC_RLE = 1,   // (value, LEB128 run length) pairs
+        CODEC_LZ = 2     // LZ77 sequences with 16-bit offsets
+    };
+
+    // Largest chunk side read or written; a chunk is decoded whole, so a
+    // bigger one would cost a huge scratch grid per read
+    static const int MAX_CHUNK_SIZE = 1024;
+
+    TilemapFile();
+    ~TilemapFile();
+
+    // Map the file read-only and check its header and index; chunks are
+    // decoded later by readChunk. Errors go to std::cerr.
+    bool open(const std::string &path);
+    void close();
+    bool isOpen() const { return data != nullptr; }
+
+    int getWidth() const { return width; }
+    int getHeight() const { return height; }
+    int getChunkSize() const { return chunkSize; }
+    int getChunksAcross() const { return chunksAcross; }
+    int getChunksDown() const { return chunksDown; }
+    const std::vector<int>& getPalette() const { return palette; }
+    size_t getFileSize() const { return fileSize; }
+
+    // Decode one chunk into a chunkSize square of palette indices. On a
+    // damaged payload, or one holding indices past the palette, the chunk
+    // is left all 0 and false is returned. Safe to call from several
+    // threads at once.
+    bool readChunk(int chunkX, int chunkY, TileGrid &out) const;
+
+    // Write a map of palette indices and its palette (tile ids, -1 = none)
+    static bool save(const std::string &path, const TileGrid &cells,
+                     const std::vector<int> &palette, int chunkSize = 64);
+    static bool save(const std::string &path, const SparseTileGrid &cells,
+                     const std::vector<int> &palette, int chunkSize = 64);
+};
+
+#endif // TILEMAP_FILE_H